@@ -18,7 +18,8 @@ public:
         m_screenToWorld = Inverse(w2s);
     }
 
-    void GenerateRay(const Float2& pos, Sampler& sampler, Ray& ray) const {
+    template<typename SamplerT>
+    void GenerateRay(const Float2& pos, SamplerT& sampler, Ray& ray) const {
         Float3 p = m_screenToWorld.TransformPoint(Float3(pos + sampler.Next2D(), -0.1f));
         Float3 o = m_cameraToWorld.TransformPoint(Float3(0, 0, 0));
         ray = Ray(o, Normalize(p - o), m_medium);
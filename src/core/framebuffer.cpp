@@ -49,6 +49,14 @@ void Framebuffer::AddSample(int x, int y, const Spectrum& s)
     m_image[idx] = (m_accumulate[idx] / float(m_sampleNum[idx])).TosRGB();
 }
 
+void Framebuffer::SetSample(int x, int y, const Spectrum& s)
+{
+    int idx = y * m_width + x;
+    m_sampleNum[idx] = 1;
+    m_accumulate[idx] = s;
+    m_image[idx] = s.TosRGB();
+}
+
 void Framebuffer::SetVal(int x, int y, const Spectrum& s)
 {
     if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
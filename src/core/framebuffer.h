@@ -22,6 +22,8 @@ public:
 
     void Initialize();
     void AddSample(int x, int y, const Spectrum& s);
+    // Replaces the pixel, for estimators that keep their own per-pixel statistics
+    void SetSample(int x, int y, const Spectrum& s);
     void Save(const std::string& suffix = "");
     sRGB* GetsRGBBuffer() const;
     sRGB GetPixelSpectrum(const Int2& pos) const;
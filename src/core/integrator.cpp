@@ -1,7 +1,5 @@
 #include "integrator.h"
 
-#include <sampler/independent.h>
-
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
 #include <tbb/concurrent_vector.h>
@@ -54,8 +52,9 @@ void Integrator::Save()
 
 SampleIntegrator::~SampleIntegrator()
 {
-    if (m_renderThread->joinable()) {
-        m_renderThread->join();
+    if (m_renderThread) {
+        Wait();
+        delete m_renderThread;
     }
 }
 
@@ -77,7 +76,11 @@ void SampleIntegrator::Start()
     // Initialize render status (start)
     m_rendering = true;
     m_timer.Start();
-    // Add render thread
+    // Add render thread, animations start once per frame
+    if (m_renderThread) {
+        Wait();
+        delete m_renderThread;
+    }
     m_renderThread = new std::thread(
         [this] {
             tbb::blocked_range<int> range(0, m_tiles.size());
@@ -118,28 +121,6 @@ bool SampleIntegrator::IsRendering()
     return m_rendering;
 }
 
-void SampleIntegrator::RenderTile(const Framebuffer::Tile& tile)
-{
-    IndependentSampler sampler;
-    unsigned int s = tile.pos[1] * m_buffer->m_width + tile.pos[0];
-    sampler.Setup(s);
-
-    for (int j = 0; j < tile.res[1]; j++) {
-        for (int i = 0; i < tile.res[0]; i++) {
-            for (uint32_t k = 0; k < m_spp; k++) {
-                if (!m_rendering) {
-                    break;
-                }
-                int x = i + tile.pos[0], y = j + tile.pos[1];
-                Ray ray;
-                m_camera->GenerateRay(Float2(x, y), sampler, ray);
-                Spectrum radiance = Li(ray, sampler);
-                m_buffer->AddSample(x, y, radiance);
-            }
-        }
-    }
-}
-
 Spectrum SampleIntegrator::NormalCheck(Ray ray, Sampler& sampler)
 {
     Spectrum radiance(0.f);
@@ -5,6 +5,9 @@
 #include "camera.h"
 #include "light/arealight.h"
 #include "utility/timer.h"
+#include "sampler/independent.h"
+#include "sampler/zsobol.h"
+#include "sampler/buffered.h"
 
 #include <thread>
 #include <atomic>
@@ -22,7 +25,6 @@ public:
         m_camera->Setup(m_buffer->m_width, m_buffer->m_height);
         m_scene->Setup();
     }
-    virtual Spectrum Li(Ray ray, Sampler& sampler) = 0;
     virtual void Start() = 0;
     virtual void Stop() = 0;
     virtual void Wait() = 0;
@@ -51,8 +53,10 @@ public:
         const std::shared_ptr<Scene>& scene,
         const std::shared_ptr<Camera>& camera,
         const std::shared_ptr<Framebuffer>& buffer,
-        const uint32_t& spp)
-        : Integrator(scene, camera, buffer), m_spp(spp) {}
+        const uint32_t& spp,
+        const SamplerType& samplerType = SamplerType::Independent)
+        : Integrator(scene, camera, buffer), m_renderThread(nullptr), m_spp(spp), m_samplerType(samplerType),
+        m_sampleDimension(64) {}
     ~SampleIntegrator();
 
     // Schedule
@@ -60,10 +64,17 @@ public:
     virtual void Stop();
     virtual void Wait();
     virtual bool IsRendering();
-    virtual void RenderTile(const Framebuffer::Tile& tile);
+    virtual void RenderTile(const Framebuffer::Tile& tile) = 0;
     // Debug
     virtual Spectrum NormalCheck(Ray ray, Sampler& sampler);
 protected:
+    // Dispatch on the sampler type chosen at parse time,
+    // T::Li is instantiated for every concrete sampler
+    template<typename T>
+    void RenderTile(const Framebuffer::Tile& tile, T* integrator);
+    template<typename T, typename SamplerT>
+    void RenderTile(const Framebuffer::Tile& tile, T* integrator, SamplerT& sampler);
+
     // Muti-thread setting
     std::atomic<bool> m_rendering;
     std::vector<Framebuffer::Tile> m_tiles;
@@ -71,4 +82,52 @@ protected:
 
     // Options
     uint32_t m_spp;
+    SamplerType m_samplerType;
+    // Expected number of dimensions per path, used to size sample buffers
+    uint32_t m_sampleDimension;
 };
+
+template<typename T>
+void SampleIntegrator::RenderTile(const Framebuffer::Tile& tile, T* integrator)
+{
+    switch (m_samplerType) {
+    case SamplerType::ZSobol: {
+        ZSobolSampler sampler(m_spp, Int2(m_buffer->m_width, m_buffer->m_height));
+        RenderTile(tile, integrator, sampler);
+        break;
+    }
+    case SamplerType::Buffered: {
+        BufferedSampler sampler(m_sampleDimension);
+        RenderTile(tile, integrator, sampler);
+        break;
+    }
+    default: {
+        IndependentSampler sampler;
+        RenderTile(tile, integrator, sampler);
+        break;
+    }
+    }
+}
+
+template<typename T, typename SamplerT>
+void SampleIntegrator::RenderTile(const Framebuffer::Tile& tile, T* integrator, SamplerT& sampler)
+{
+    unsigned int s = tile.pos[1] * m_buffer->m_width + tile.pos[0];
+    sampler.Setup(s);
+
+    for (int j = 0; j < tile.res[1]; j++) {
+        for (int i = 0; i < tile.res[0]; i++) {
+            for (uint32_t k = 0; k < m_spp; k++) {
+                if (!m_rendering) {
+                    break;
+                }
+                int x = i + tile.pos[0], y = j + tile.pos[1];
+                sampler.StartPixel(Int2(x, y), k);
+                Ray ray;
+                m_camera->GenerateRay(Float2(x, y), sampler, ray);
+                Spectrum radiance = integrator->Li(ray, sampler);
+                m_buffer->AddSample(x, y, radiance);
+            }
+        }
+    }
+}
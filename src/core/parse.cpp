@@ -17,13 +17,16 @@
 #include "light/environment.h"
 #include "light/directional.h"
 #include "light/point.h"
+#include "light/volume.h"
 #include "medium/hg.h"
 #include "medium/homogeneous.h"
 #include "medium/heterogeneous.h"
+#include "medium/animated.h"
 #include "integrator/pathtracer.h"
 #include "integrator/volumepathtracer.h"
 #include "integrator/pathguider.h"
 #include "integrator/pppm.h"
+#include "integrator/sppm.h"
 #include "integrator/vppm.h"
 #include "integrator/director.h"
 #include "texture/consttexture.h"
@@ -100,6 +103,66 @@ bool ContainValue(const json::value_type& node, const std::string name) {
     return node.contains(name);
 }
 
+PhotonMapType GetPhotonMapType(const json::value_type& node) {
+    std::string type = GetString(node, "photon_map", "kdtree");
+    if (type == "kdtree") {
+        return PhotonMapType::KDTree;
+    }
+    else if (type == "hash") {
+        return PhotonMapType::HashGrid;
+    }
+    else {
+        std::cout << "Wrong photon map type\n";
+        exit(-1);
+    }
+}
+
+MediumEstimator GetMediumEstimator(const json::value_type& node) {
+    std::string type = GetString(node, "medium_estimator", "point");
+    if (type == "point") {
+        return MediumEstimator::Point;
+    }
+    else if (type == "beam") {
+        return MediumEstimator::Beam;
+    }
+    else if (type == "point_beam") {
+        return MediumEstimator::PointBeam;
+    }
+    else if (type == "beam_beam") {
+        return MediumEstimator::BeamBeam;
+    }
+    else {
+        std::cout << "Wrong medium estimator type\n";
+        exit(-1);
+    }
+}
+
+uint32_t GetKNN(const json::value_type& node) {
+    int knn = GetInt(node, "knn", 0);
+    if (knn < 0 || knn > int(KDTree::max_knn)) {
+        std::cout << "knn must be in [0, " << KDTree::max_knn << "]\n";
+        exit(-1);
+    }
+    return knn;
+}
+
+SamplerType GetSamplerType(const json::value_type& node) {
+    std::string type = GetString(node, "sampler", "independent");
+    if (type == "independent") {
+        return SamplerType::Independent;
+    }
+    else if (type == "zsobol") {
+        return SamplerType::ZSobol;
+    }
+    else if (type == "pcg32_8") {
+        return SamplerType::Buffered;
+    }
+    else {
+        std::cout << "Wrong sampler type\n";
+        exit(-1);
+    }
+}
+
 void Parse(const std::string& filename, Renderer& renderer)
 {
     std::filesystem::path path(filename);
@@ -134,15 +197,21 @@ void Parse(const std::string& filename, Renderer& renderer)
                 }
             }
 
-            Medium* medium = nullptr;
+            std::shared_ptr<Medium> medium = nullptr;
             if (mediumType == "homogeneous") {
                 Spectrum density = GetSpectrum(mediumProperties, "density", Spectrum(1));
                 Spectrum albedo = GetSpectrum(mediumProperties, "albedo", Spectrum(0.5f));
                 float scale = GetFloat(mediumProperties, "scale", 1);
-                medium = new HomogeneousMedium(std::shared_ptr<PhaseFunction>(pf), density, albedo, scale);
+                int msDepth = GetInt(mediumProperties, "ms_depth", 0);
+                int msOctaves = GetInt(mediumProperties, "ms_octaves", 4);
+                float msExtinction = GetFloat(mediumProperties, "ms_extinction", .5f);
+                float msScattering = GetFloat(mediumProperties, "ms_scattering", .5f);
+                medium = std::make_shared<HomogeneousMedium>(std::shared_ptr<PhaseFunction>(pf), density, albedo, scale,
+                    msDepth, msOctaves, msExtinction, msScattering);
             }
-            else if (mediumType == "heterogeneous") {
-                //std::string estimator = GetString(mediumProperties, "estimator", "ratio_tracking");
+            else if (mediumType == "heterogeneous" || mediumType == "animated") {
+                std::string estimator = GetString(mediumProperties, "estimator", "ratio");
+                bool decomposition = GetBool(mediumProperties, "decomposition", true);
                 std::string filename = GetString(mediumProperties, "filename", "");
                 bool lefthand = GetBool(mediumProperties, "left_hand", true);
                 std::string densityName = GetString(mediumProperties, "density", "density");
@@ -151,15 +220,43 @@ void Parse(const std::string& filename, Renderer& renderer)
                 Spectrum albedo = GetSpectrum(mediumProperties, "albedo", Spectrum(0.5f));
                 float scale = GetFloat(mediumProperties, "scale", 1);
                 float temperatureScale = GetFloat(mediumProperties, "temperature_scale", 1);
-                medium = new HeterogeneousMedium(
-                    std::shared_ptr<PhaseFunction>(pf),
-                    filename, lefthand, densityName, blackbody, temperatureName, albedo, scale, temperatureScale);
+                int majorantBlockSize = GetInt(mediumProperties, "majorant_block_size", 16);
+                std::string storage = GetString(mediumProperties, "storage", "vdb");
+                int quantization = GetInt(mediumProperties, "quantization", 32);
+                bool benchmark = GetBool(mediumProperties, "benchmark", false);
+                int mipLevels = GetInt(mediumProperties, "mip_levels", 0);
+                int mipDepth = GetInt(mediumProperties, "mip_depth", 1);
+                float mipThroughput = GetFloat(mediumProperties, "mip_throughput", 0);
+                std::shared_ptr<PhaseFunction> phaseFunction(pf);
+                // Every frame of a sequence shares the parameters
+                auto loader = [=](const std::string& frameFilename) {
+                    auto heterogeneousMedium = std::make_shared<HeterogeneousMedium>(
+                        phaseFunction, frameFilename, lefthand, densityName, blackbody, temperatureName,
+                        albedo, scale, temperatureScale, majorantBlockSize, storage, quantization,
+                        estimator, decomposition, mipLevels, mipDepth, mipThroughput);
+                    if (benchmark) {
+                        heterogeneousMedium->Benchmark();
+                    }
+                    return heterogeneousMedium;
+                };
+                if (mediumType == "heterogeneous") {
+                    medium = loader(filename);
+                }
+                else {
+                    int frameStart = GetInt(mediumProperties, "frame_start", 0);
+                    int frameEnd = GetInt(mediumProperties, "frame_end", frameStart);
+                    int cacheSize = GetInt(mediumProperties, "cache_size", 3);
+                    auto animatedMedium = std::make_shared<AnimatedMedium>(
+                        phaseFunction, filename, frameStart, frameEnd, cacheSize, loader);
+                    scene->m_animatedMedia.push_back(animatedMedium);
+                    medium = animatedMedium;
+                }
             }
             else {
                 LOG(FATAL) << "Wrong medium type " << mediumType;
             }
 
-            scene->AddMedium(mediumName, std::shared_ptr<Medium>(medium));
+            scene->AddMedium(mediumName, medium);
         }
     }
 
@@ -410,6 +507,15 @@ void Parse(const std::string& filename, Renderer& renderer)
                 auto light = std::shared_ptr<PointLight>(new PointLight(position, intensity * scale, mi));
                 scene->m_lights.push_back(light);
             }
+            else if (lightType == "volume") {
+                std::string mediumName = lightProperties["medium"];
+                auto medium = std::dynamic_pointer_cast<HeterogeneousMedium>(scene->GetMedium(mediumName));
+                LOG_IF(FATAL, !medium) << "Volume light needs a heterogeneous medium.";
+                int blockSize = GetInt(lightProperties, "block_size", 8);
+                float scale = GetFloat(lightProperties, "scale", 1.f);
+                auto light = std::shared_ptr<VolumeLight>(new VolumeLight(medium, blockSize, scale));
+                scene->m_lights.push_back(light);
+            }
             else {
                 assert(false);
             }
@@ -452,7 +558,8 @@ void Parse(const std::string& filename, Renderer& renderer)
         if (type == "path_tracer" || type == "pt") {
             int maxBounce = GetInt(integratorProperties, "max_bounce", 10);
             int spp = GetInt(integratorProperties, "spp", 1);
-            integrator = std::make_shared<PathIntegrator>(scene, camera, buffer, maxBounce, spp);
+            SamplerType samplerType = GetSamplerType(integratorProperties);
+            integrator = std::make_shared<PathIntegrator>(scene, camera, buffer, maxBounce, spp, samplerType);
         }
         else if (type == "path_guider" || type == "pg") {
             int maxBounce = GetInt(integratorProperties, "max_bounce", 10);
@@ -466,17 +573,31 @@ void Parse(const std::string& filename, Renderer& renderer)
             int deltaPhotonNum = GetInt(integratorProperties, "delta_photon_num", 10000);
             float initialRadius = GetFloat(integratorProperties, "initial_radius", 1);
             float alpha = GetFloat(integratorProperties, "alpha", 2.f / 3.f);
+            PhotonMapType photonMapType = GetPhotonMapType(integratorProperties);
+            bool benchmark = GetBool(integratorProperties, "benchmark", false);
+            uint32_t knn = GetKNN(integratorProperties);
+            if (knn > 0 && photonMapType != PhotonMapType::KDTree) {
+                std::cout << "k-NN queries need the kdtree photon map\n";
+                exit(-1);
+            }
             integrator = std::make_shared<PPPMIntegrator>(scene, camera, buffer, maxBounce,
-                maxIteration, deltaPhotonNum, initialRadius, alpha);
+                maxIteration, deltaPhotonNum, initialRadius, alpha, photonMapType, benchmark, knn);
         }
         else if (type == "sppm") {
-            std::cout << "Wrong integrator type\n";
-            exit(-1);
+            int maxBounce = GetInt(integratorProperties, "max_bounce", 10);
+            int maxIteration = GetInt(integratorProperties, "max_iteration", 1);
+            int deltaPhotonNum = GetInt(integratorProperties, "delta_photon_num", 10000);
+            float initialRadius = GetFloat(integratorProperties, "initial_radius", 1);
+            float alpha = GetFloat(integratorProperties, "alpha", 2.f / 3.f);
+            integrator = std::make_shared<SPPMIntegrator>(scene, camera, buffer, maxBounce,
+                maxIteration, deltaPhotonNum, initialRadius, alpha);
         }
         else if (type == "volume_path_tracer" || type == "vpt") {
             int maxBounce = GetInt(integratorProperties, "max_bounce", 10);
             int spp = GetInt(integratorProperties, "spp", 1);
-            integrator = std::make_shared<VolumePathIntegrator>(scene, camera, buffer, maxBounce, spp);
+            SamplerType samplerType = GetSamplerType(integratorProperties);
+            bool equiangular = GetBool(integratorProperties, "equiangular", false);
+            integrator = std::make_shared<VolumePathIntegrator>(scene, camera, buffer, maxBounce, spp, samplerType, equiangular);
         }
         else if (type == "vppm") {
             int maxBounce = GetInt(integratorProperties, "max_bounce", 10);
@@ -484,15 +605,18 @@ void Parse(const std::string& filename, Renderer& renderer)
             int deltaPhotonNum = GetInt(integratorProperties, "delta_photon_num", 10000);
             float initialRadius = GetFloat(integratorProperties, "initial_radius", 1);
             float alpha = GetFloat(integratorProperties, "alpha", 2.f / 3.f);
+            MediumEstimator mediumEstimator = GetMediumEstimator(integratorProperties);
+            uint32_t knn = GetKNN(integratorProperties);
             integrator = std::shared_ptr<VPPMIntegrator>(new VPPMIntegrator(scene, camera, buffer, maxBounce,
-                maxIteration, deltaPhotonNum, initialRadius, alpha));
+                maxIteration, deltaPhotonNum, initialRadius, alpha, mediumEstimator, knn));
             //integrator = std::make_shared<VPPMIntegrator>(scene, camera, buffer, maxBounce,
             //    maxIteration, deltaPhotonNum, initialRadius, alpha);
         }
         else if (type == "director") {
             int maxBounce = GetInt(integratorProperties, "max_bounce", 10);
             int spp = GetInt(integratorProperties, "spp", 1);
-            integrator = std::make_shared<DirectorIntegrator>(scene, camera, buffer, maxBounce, spp);
+            SamplerType samplerType = GetSamplerType(integratorProperties);
+            integrator = std::make_shared<DirectorIntegrator>(scene, camera, buffer, maxBounce, spp, samplerType);
         }
         else {
             assert(false);
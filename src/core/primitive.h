@@ -6,6 +6,7 @@
 #include "record.h"
 #include "camera.h"
 #include "sampling.h"
+#include "sampler.h"
 #include "texture.h"
 
 class AreaLight;
@@ -49,12 +50,21 @@ public:
 
 class Medium {
 public:
-    Medium(const std::shared_ptr<PhaseFunction>& pf) :m_phaseFunction(pf) {}
-
-    virtual Spectrum Sample(const Ray& ray, MediumRecord& mediumRec, Sampler& sampler) const = 0;
-    virtual Spectrum Transmittance(const Ray& ray, Sampler& sampler) const = 0;
+    Medium(const std::shared_ptr<PhaseFunction>& pf) :m_phaseFunction(pf), m_hasVolumeLight(false) {}
+
+    // _level_ selects a coarser density representation, 0 is full resolution
+    virtual Spectrum Sample(const Ray& ray, MediumRecord& mediumRec, Sampler& sampler, const uint32_t& level = 0) const = 0;
+    virtual Spectrum Transmittance(const Ray& ray, Sampler& sampler, const uint32_t& level = 0) const = 0;
+    virtual Spectrum SigmaS(const Float3& p) const = 0;
+    virtual Spectrum SigmaT(const Float3& p) const = 0;
+    // Pdf of Sample() returning a collision at distance t along the ray
+    virtual float PdfDistance(const Ray& ray, const float& t, Sampler& sampler) const = 0;
+    // Level of detail for a path at _depth_ carrying _throughput_
+    virtual uint32_t SelectLevel(const uint32_t& depth, const Spectrum& throughput) const { return 0; }
 
     std::shared_ptr<PhaseFunction> m_phaseFunction;
+    // Emission is sampled by a VolumeLight, collisions only count it when no light sample was taken
+    bool m_hasVolumeLight;
 };
 
 class MediumInterface {
@@ -82,8 +92,16 @@ public:
     virtual Spectrum EvalPdf(LightRecord& lightRec) const = 0;
     // Sample photon's position, direction and flux
     virtual Spectrum SamplePhoton(Float2& s1, Float2& s2, Ray& ray) const = 0;
+    // Lights needing more than the given dimensions draw them from _sampler_
+    virtual Spectrum Sample(LightRecord& lightRec, Float2& s, Sampler& sampler) const {
+        return Sample(lightRec, s);
+    }
+    virtual Spectrum SamplePhoton(Float2& s1, Float2& s2, Sampler& sampler, Ray& ray) const {
+        return SamplePhoton(s1, s2, ray);
+    }
 
     virtual bool IsDelta() const { return false; }
+    virtual bool IsInfinite() const { return false; }
 
     MediumInterface m_mediumInterface;
 };
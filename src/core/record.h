@@ -80,11 +80,11 @@ public:
 
 class LightRecord {
 public:
-    LightRecord() {}
-    LightRecord(const Float3& _ref) :m_ref(_ref) {}
+    LightRecord() :m_volume(false) {}
+    LightRecord(const Float3& _ref) :m_ref(_ref), m_volume(false) {}
     LightRecord(const Float3& _ref, const GeometryRecord& _geoRec)
-        :m_ref(_ref), m_geoRec(_geoRec) {}
-    LightRecord(const Ray& ray) :m_ref(ray.o), m_wi(ray.d) {}
+        :m_ref(_ref), m_geoRec(_geoRec), m_volume(false) {}
+    LightRecord(const Ray& ray) :m_ref(ray.o), m_wi(ray.d), m_volume(false) {}
 
     Float3 m_ref;
 
@@ -92,6 +92,9 @@ public:
     Float3 m_wi;
     float m_pdf;
     Ray m_shadowRay;
+    // Sampled inside a volume, m_pdf is per unit volume times dist^2 and
+    // BSDF or phase sampling can't reach the light
+    bool m_volume;
 };
 
 class DebugRecord {
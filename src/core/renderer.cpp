@@ -159,6 +159,23 @@ void Renderer::Render(bool mute)
 {    
     ImVec4 clear_color = ImVec4(0.62f, 0.87f, 1.00f, 1.00f);
 
+    // Batch render every frame of an animated scene
+    int frameStart, frameEnd;
+    if (mute && m_scene->GetFrameRange(frameStart, frameEnd)) {
+        for (int frame = frameStart; frame <= frameEnd; frame++) {
+            std::cout << "Frame " << frame << std::endl;
+            // Frame + 1 is prefetched while this one renders
+            m_scene->SetFrame(frame);
+            m_buffer->ClearOutputBuffer();
+            m_integrator->Start();
+            while (m_integrator->IsRendering());
+            m_integrator->Stop();
+            m_integrator->Wait();
+            m_buffer->Save(fmt::format("{:04d}", frame));
+        }
+        return;
+    }
+
     //Start rendering
     m_integrator->Start();
 
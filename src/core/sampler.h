@@ -3,24 +3,23 @@
 #include "global.h"
 #include "vector.h"
 
-#include <random>
+enum class SamplerType {
+    Independent,
+    ZSobol,
+    Buffered
+};
 
+// Sampler interface, integrators are templated on the concrete (final)
+// sampler so that calls in the path loop are resolved at compile time
 class Sampler {
 public:
     Sampler() {}
 
-    virtual void Setup(uint64_t s) {
-        m_engine.seed(s);        
-    }
+    virtual void Setup(uint64_t s) = 0;
 
-    virtual float Next1D() {
-        return m_rng(m_engine);
-    }
-    virtual Float2 Next2D() {
-        return Float2(Next1D(), Next1D());
-    }
+    // Called before the camera ray of every pixel sample
+    virtual void StartPixel(const Int2& pixel, const uint32_t& index) {}
 
-private:
-    std::default_random_engine m_engine;
-    std::uniform_real_distribution<float> m_rng;
+    virtual float Next1D() = 0;
+    virtual Float2 Next2D() = 0;
 };
\ No newline at end of file
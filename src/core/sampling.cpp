@@ -60,6 +60,28 @@ int SampleDiscrete(const std::vector<float>& pdfs, float u)
     }
 }
 
+float SampleEquiangular(const Ray& ray, const Float3& p, const float& s, float& pdf)
+{
+    // Project the point onto the ray
+    float delta = Dot(p - ray.o, ray.d);
+    float D = std::max(Length(ray(delta) - p), 1e-6f);
+    float thetaA = std::atan2(-delta, D);
+    float thetaB = std::atan2(ray.tMax - delta, D);
+    float t = D * std::tan(thetaA + s * (thetaB - thetaA));
+    pdf = D / ((thetaB - thetaA) * (D * D + t * t));
+    return std::clamp(delta + t, 0.f, ray.tMax);
+}
+
+float PdfEquiangular(const Ray& ray, const Float3& p, const float& t)
+{
+    float delta = Dot(p - ray.o, ray.d);
+    float D = std::max(Length(ray(delta) - p), 1e-6f);
+    float thetaA = std::atan2(-delta, D);
+    float thetaB = std::atan2(ray.tMax - delta, D);
+    float x = t - delta;
+    return D / ((thetaB - thetaA) * (D * D + x * x));
+}
+
 Distribution1D::Distribution1D(const float* ptr, int n)
     :m_func(ptr, ptr + n), m_cdf(n + 1)
 {
@@ -70,4 +70,7 @@ float PdfCosineHemisphere(const Float3& v);
 Float2 SampleUniformTriangle(const Float2& s);
 Float3 SampleUniformSphere(const Float2& s);
 float PdfUniformSphere(const Float3& v);
-int SampleDiscrete(const std::vector<float>& pdfs, float u);
\ No newline at end of file
+int SampleDiscrete(const std::vector<float>& pdfs, float u);
+// Equiangular distance sampling on [0, ray.tMax] toward point p (Kulla and Fajardo 2012)
+float SampleEquiangular(const Ray& ray, const Float3& p, const float& s, float& pdf);
+float PdfEquiangular(const Ray& ray, const Float3& p, const float& t);
\ No newline at end of file
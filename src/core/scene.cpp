@@ -1,6 +1,7 @@
 #include "scene.h"
 #include "light/arealight.h"
 #include "light/environment.h"
+#include "medium/animated.h"
 
 std::shared_ptr<Mesh> Scene::GetMesh(const std::string& name)
 {
@@ -95,6 +96,11 @@ void Scene::AddSpectrumTexture(const std::string& name, const std::shared_ptr<Te
 void Scene::Setup()
 {
     assert(!m_lights.empty() || !m_environmentLights.empty());
+    // Integrators call this on every start, animation frames only switch
+    // media through SetFrame() so the geometry is built once
+    if (m_embreeBvh) {
+        return;
+    }
     std::cout << "Building BVH" << std::endl;
     for (Primitive& p : m_primitives) {
         m_bounds = Union(m_bounds, p.m_shape->GetBounds());
@@ -106,6 +112,27 @@ void Scene::Setup()
     std::cout << "BVH Done" << std::endl;
 }
 
+void Scene::SetFrame(const int& frame)
+{
+    for (const auto& medium : m_animatedMedia) {
+        medium->SetFrame(std::clamp(frame, medium->m_frameStart, medium->m_frameEnd));
+    }
+}
+
+bool Scene::GetFrameRange(int& frameStart, int& frameEnd) const
+{
+    if (m_animatedMedia.empty()) {
+        return false;
+    }
+    frameStart = std::numeric_limits<int>::max();
+    frameEnd = std::numeric_limits<int>::min();
+    for (const auto& medium : m_animatedMedia) {
+        frameStart = std::min(frameStart, medium->m_frameStart);
+        frameEnd = std::max(frameEnd, medium->m_frameEnd);
+    }
+    return true;
+}
+
 bool Scene::Intersect(Ray& ray, HitRecord& hitRec) const
 {
     return m_embreeBvh->Intersect(ray, hitRec);
@@ -124,7 +151,7 @@ bool Scene::Intersect(Ray& ray, HitRecord& hitRec) const
     return hit;
 }
 
-bool Scene::IntersectTr(Ray& ray, HitRecord& hitRec, Spectrum& transmittance, Sampler& sampler) const
+bool Scene::IntersectTr(Ray& ray, HitRecord& hitRec, Spectrum& transmittance, Sampler& sampler, const uint32_t& level) const
 {
     transmittance = Spectrum(1.f);
     while (true) {
@@ -133,7 +160,7 @@ bool Scene::IntersectTr(Ray& ray, HitRecord& hitRec, Spectrum& transmittance, Sa
             return false;
         }
         if (ray.m_medium) {
-            transmittance *= ray.m_medium->Transmittance(ray, sampler);
+            transmittance *= ray.m_medium->Transmittance(ray, sampler, level);
         }
         const auto& bsdf = hitRec.m_primitive->m_bsdf;
         if (bsdf && !bsdf->IsTransparent()) {
@@ -196,16 +223,18 @@ bool Scene::OccludeTr(Ray& _ray, Spectrum& transmittance, Sampler& sampler) cons
     while (true) {
         HitRecord hitRec;
         bool hit = Intersect(ray, hitRec);
-        const auto& bsdf = hitRec.m_primitive->m_bsdf;
-        if (hit && bsdf) {
-            if (!bsdf->IsTransparent()) {
-                transmittance = Spectrum(0.f);
-                return true;
-            }
-        }
         if (!hit) {
+            // Lights inside a medium, e.g. volume lights
+            if (ray.m_medium) {
+                transmittance *= ray.m_medium->Transmittance(ray, sampler);
+            }
             return false;
         }
+        const auto& bsdf = hitRec.m_primitive->m_bsdf;
+        if (bsdf && !bsdf->IsTransparent()) {
+            transmittance = Spectrum(0.f);
+            return true;
+        }
         if (ray.m_medium) {
             transmittance *= ray.m_medium->Transmittance(ray, sampler);
         }
@@ -235,7 +264,7 @@ Spectrum Scene::SampleLight(LightRecord& lightRec, const Float2& _s, Sampler& sa
     float lightChoosePdf = 1.f / lightNum;
     s.x = s.x * lightNum - lightIdx;
     const auto& light = m_lights[lightIdx];
-    Spectrum emission = light->Sample(lightRec, s);
+    Spectrum emission = light->Sample(lightRec, s, sampler);
     lightRec.m_shadowRay.m_medium = medium;
 
     if (lightRec.m_pdf != 0) {
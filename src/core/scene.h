@@ -8,12 +8,19 @@
 #include "shape/triangle.h"
 #include "light/environment.h"
 
+class AnimatedMedium;
+
 class Scene {
 public:
     void Setup();
+    // Switch every animated medium to _frame_, clamped to its range
+    void SetFrame(const int& frame);
+    // Union of the animated frame ranges, false for static scenes
+    bool GetFrameRange(int& frameStart, int& frameEnd) const;
 
     bool Intersect(Ray& ray, HitRecord& hitRec) const;
-    bool IntersectTr(Ray& ray, HitRecord& hitRec, Spectrum& transmittance, Sampler& sampler) const;
+    // Skips transparent surfaces, media are tracked at _level_
+    bool IntersectTr(Ray& ray, HitRecord& hitRec, Spectrum& transmittance, Sampler& sampler, const uint32_t& level = 0) const;
     bool Occlude(Ray& ray) const;
     bool OccludeTransparent(Ray& ray, Spectrum& throughput) const;
     bool OccludeTr(Ray& ray, Spectrum& transmittance, Sampler& sampler) const;
@@ -28,6 +35,7 @@ public:
     std::vector<Primitive> m_primitives;
     std::vector<std::shared_ptr<Light>> m_lights;
     std::vector<std::shared_ptr<EnvironmentLight>> m_environmentLights;
+    std::vector<std::shared_ptr<AnimatedMedium>> m_animatedMedia;
     Bounds m_bounds;
 
 
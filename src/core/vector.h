@@ -134,7 +134,7 @@ inline float Ray::shadowEpsilon = 1e-3;
 
 class Bounds {
 public:
-    Bounds() :m_pMin(std::numeric_limits<float>::max()), m_pMax(std::numeric_limits<float>::min()) {}
+    Bounds() :m_pMin(std::numeric_limits<float>::max()), m_pMax(std::numeric_limits<float>::lowest()) {}
     Bounds(const Float3& p) :m_pMin(p), m_pMax(p) {}
     Bounds(const Float3& pMin, const Float3& pMax) :m_pMin(pMin), m_pMax(pMax) {}
     Bounds(const Float3& center, const float& radius) :
@@ -189,6 +189,27 @@ public:
         return ray.tMin <= farT && nearT <= ray.tMax;
     }
 
+    // Return the parametric overlap of the whole ray line with the bounds
+    bool Intersect(const Ray& ray, float& nearT, float& farT) const {
+        nearT = -std::numeric_limits<float>::infinity();
+        farT = std::numeric_limits<float>::infinity();
+        for (int i = 0; i < 3; i++) {
+            float invDir = 1.f / ray.d[i];
+            float t1 = (m_pMin[i] - ray.o[i]) * invDir;
+            float t2 = (m_pMax[i] - ray.o[i]) * invDir;
+            if (t1 > t2) {
+                std::swap(t1, t2);
+            }
+            // NaN (origin on a slab of a parallel ray) keeps the interval
+            nearT = t1 > nearT ? t1 : nearT;
+            farT = t2 < farT ? t2 : farT;
+            if (nearT > farT) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     bool Intersect(const Ray& ray, const Float3& invDir, const int* dirIsNeg) const {
         const Bounds& bounds = *this;
 
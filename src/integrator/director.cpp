@@ -1,6 +1,7 @@
 #include "director.h"
 
-Spectrum DirectorIntegrator::Li(Ray ray, Sampler& sampler)
+template<typename SamplerT>
+Spectrum DirectorIntegrator::Li(Ray ray, SamplerT& sampler)
 {
     Spectrum radiance(0.f);
     for (int i = 0; i < 1; i++) {
@@ -36,6 +37,11 @@ Spectrum DirectorIntegrator::Li(Ray ray, Sampler& sampler)
     return radiance;
 }
 
+void DirectorIntegrator::RenderTile(const Framebuffer::Tile& tile)
+{
+    SampleIntegrator::RenderTile(tile, this);
+}
+
 std::string DirectorIntegrator::ToString() const
 {
     return fmt::format("Director(SVBRDF)\nspp : {0}\nmax bounce : {1}", m_spp, m_maxBounce);
@@ -49,7 +55,7 @@ void DirectorIntegrator::Debug(DebugRecord& debugRec)
             pos.y >= 0 && pos.y < m_buffer->m_height)
         {
             int x = pos.x, y = m_buffer->m_height - pos.y;
-            Sampler sampler;
+            IndependentSampler sampler;
             unsigned int s = y * m_buffer->m_width + x;
             sampler.Setup(s);
             Ray ray;
@@ -9,10 +9,17 @@ public:
         const std::shared_ptr<Camera>& camera,
         const std::shared_ptr<Framebuffer>& buffer,
         const uint32_t maxBounce,
-        const uint32_t spp)
-        : SampleIntegrator(scene, camera, buffer, spp), m_maxBounce(maxBounce) {}
+        const uint32_t spp,
+        const SamplerType samplerType = SamplerType::Independent)
+        : SampleIntegrator(scene, camera, buffer, spp, samplerType), m_maxBounce(maxBounce)
+    {
+        // Pixel jitter, then light, bsdf/phase and roulette samples per bounce
+        m_sampleDimension = 2 + 5 * maxBounce;
+    }
 
-    Spectrum Li(Ray ray, Sampler& sampler);
+    template<typename SamplerT>
+    Spectrum Li(Ray ray, SamplerT& sampler);
+    void RenderTile(const Framebuffer::Tile& tile);
     std::string ToString() const;
 private:
     void Setup() { Integrator::Setup(); }
@@ -238,7 +238,7 @@ void Vertex::Commit()
     m_dtree->AddSample(m_d, weight.y());
 }
 
-Spectrum PathGuiderIntegrator::Li(Ray ray, Sampler& sampler)
+Spectrum PathGuiderIntegrator::Li(Ray ray, IndependentSampler& sampler)
 {
     Spectrum radiance(0.f);
     Spectrum throughput(1.f);
@@ -543,7 +543,7 @@ void PathGuiderIntegrator::RenderTile(
     const uint32_t& spp, 
     const uint32_t& iteration)
 {
-    Sampler sampler;
+    IndependentSampler sampler;
     uint64_t s = (tile.pos[1] * m_buffer->m_width + tile.pos[0]) + 
         iteration * (m_buffer->m_width * m_buffer->m_height);
     sampler.Setup(s);
@@ -578,7 +578,7 @@ void PathGuiderIntegrator::Debug(DebugRecord& debugRec)
             pos.y >= 0 && pos.y < m_buffer->m_height)
         {
             int x = pos.x, y = m_buffer->m_height - pos.y;
-            Sampler sampler;
+            IndependentSampler sampler;
             unsigned int s = y * m_buffer->m_width + x;
             sampler.Setup(s);
             Ray ray;
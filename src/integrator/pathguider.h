@@ -163,7 +163,7 @@ public:
         : Integrator(scene, camera, buffer), 
         m_maxBounce(maxBounce), m_initSpp(initSpp), m_maxIteration(maxIteration) {}
 
-    Spectrum Li(Ray ray, Sampler& sampler);
+    Spectrum Li(Ray ray, IndependentSampler& sampler);
     void Start();
     void Stop();
     void Wait();
@@ -1,7 +1,8 @@
 #include "pathtracer.h"
 #include "light/environment.h"
 
-Spectrum PathIntegrator::Li(Ray ray, Sampler& sampler)
+template<typename SamplerT>
+Spectrum PathIntegrator::Li(Ray ray, SamplerT& sampler)
 {
     Spectrum radiance(0.f);
     Spectrum throughput(1.f);
@@ -154,6 +155,11 @@ Spectrum PathIntegrator::SampleLight(LightRecord& lightRec, Float2& s) const
     }
 }
 
+void PathIntegrator::RenderTile(const Framebuffer::Tile& tile)
+{
+    SampleIntegrator::RenderTile(tile, this);
+}
+
 std::string PathIntegrator::ToString() const
 {
     return fmt::format("Path Tracer\nspp : {0}\nmax bounce : {1}", m_spp, m_maxBounce);
@@ -168,7 +174,7 @@ void PathIntegrator::Debug(DebugRecord& debugRec)
             pos.y >= 0 && pos.y < m_buffer->m_height)
         {
             int x = pos.x, y = m_buffer->m_height - pos.y;
-            Sampler sampler;
+            IndependentSampler sampler;
             unsigned int s = y * m_buffer->m_width + x;
             sampler.Setup(s);
             Ray ray;
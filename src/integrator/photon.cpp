@@ -1,176 +1,107 @@
 #include "photon.h"
 
-void KDTree::Add(const Photon& photon)
-{
-    m_mutex.lock();
-    m_photons.push_back(photon);
-    m_bounds = Union(m_bounds, Bounds(photon.m_position));
-    m_mutex.unlock();
-}
-
-uint32_t KDTree::RecursiveBuild(uint32_t l, uint32_t r, Bounds& bounds, const float& radius)
-{
-    int axis = -1, lc = -1, rc = -1;
-    uint32_t mid = (l + r) * 0.5f;
-
-    if (r - l > 1) {
-        // Non-leaf node
-        axis = bounds.MaxAxis();
-        std::nth_element(m_photons.begin() + l, m_photons.begin() + mid, m_photons.begin() + r,
-            [&](const Photon& p1, const Photon& p2)->bool {
-                return p1.m_position[axis] < p2.m_position[axis];
-            });
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
 
-        Bounds lb, rb;
-        Split(bounds, axis, m_photons[mid].m_position[axis], lb, rb);
+#include <chrono>
 
-        if (mid > l) {
-            lc = RecursiveBuild(l, mid, lb, radius);
-        }
-        if (r > mid + 1) {
-            rc = RecursiveBuild(mid + 1, r, rb, radius);
-        }
+// Subtrees smaller than this are built serially
+static constexpr uint32_t parallel_build_size = 16384;
 
-        // Build BBH        
-        if (radius != 0) {
-            //std::cout << "WTF1";
-            Bounds BBHBounds(m_photons[mid].m_position, radius);
-            if (lc != -1) BBHBounds = Union(BBHBounds, m_nodes[lc].m_bounds);
-            if (rc != -1) BBHBounds = Union(BBHBounds, m_nodes[rc].m_bounds);
-            bounds = BBHBounds;
-        }
-    }
-    else {
-        // Leaf node
-        // Build BBH        
-        if (radius != 0) {
-            //std::cout << "WTF2";
-            Bounds BBHBounds(m_photons[mid].m_position, radius);
-            bounds = BBHBounds;
+void PhotonBuffers::Gather(std::vector<Photon>& photons, Bounds& bounds)
+{
+    // Prefix sum of the buffer sizes gives every buffer its output range
+    std::vector<Buffer*> buffers;
+    std::vector<size_t> offsets;
+    size_t photonNum = photons.size();
+    for (Buffer& buffer : m_buffers) {
+        if (buffer.m_photons.empty()) {
+            continue;
         }
+        buffers.push_back(&buffer);
+        offsets.push_back(photonNum);
+        photonNum += buffer.m_photons.size();
+        bounds = Union(bounds, buffer.m_bounds);
     }
-
-    KDTreeNode node(bounds, axis, lc, rc, mid);
-    m_nodes.push_back(node);
-    return m_nodes.size() - 1;
+    photons.resize(photonNum);
+    tbb::parallel_for(size_t(0), buffers.size(), [&](size_t i) {
+        std::copy(buffers[i]->m_photons.begin(), buffers[i]->m_photons.end(), photons.begin() + offsets[i]);
+        // Keep the capacity for the next pass
+        buffers[i]->m_photons.clear();
+        buffers[i]->m_bounds = Bounds();
+    });
 }
 
-void KDTree::Build(const float& radius)
+void PhotonBuffers::Clear()
 {
-    m_root = RecursiveBuild(0, m_photons.size(), m_bounds, radius);
+    for (Buffer& buffer : m_buffers) {
+        buffer.m_photons.clear();
+        buffer.m_bounds = Bounds();
+    }
 }
 
-void KDTree::Clear()
+// Size of the left subtree of a left-balanced tree with _n_ nodes
+static uint32_t LeftSubtreeSize(const uint32_t& n)
 {
-    int photonNum = m_photons.size();
-    int nodeNum = m_nodes.size();
-    m_photons.clear();
-    m_nodes.clear();
-    m_photons.reserve(photonNum);
-    m_nodes.reserve(nodeNum);
-    m_bounds = Bounds();
+    if (n <= 1) {
+        return 0;
+    }
+    // Levels above the last one are full
+    uint32_t height = math::Log2Int(n);
+    uint32_t fullNum = (1u << height) - 1;
+    uint32_t lastLevelNum = n - fullNum;
+    uint32_t halfLastLevel = 1u << (height - 1);
+    return (halfLastLevel - 1) + std::min(lastLevelNum, halfLastLevel);
 }
 
-void KDTree::Query(const Float3& center, const float& radius, std::vector<const Photon*>& photons) const
+void KDTree::RecursiveBuild(const uint32_t& node, const uint32_t& l, const uint32_t& r, const Bounds& bounds)
 {
-    if (m_photons.empty()) return;
-    float sqrRadius = std::sqr(radius);
-    std::stack<uint32_t> stack;
-    stack.push(m_root);
-    while (!stack.empty()) {
-        uint32_t idx = stack.top(); stack.pop();
-        const auto& node = m_nodes[idx];
-        const auto& photon = m_photons[node.m_photonIndex];
-        float minSqrDistance =
-            std::sqr(std::max(0.f, std::max(center.x - node.m_bounds.m_pMax.x,
-                node.m_bounds.m_pMin.x - center.x))) +
-            std::sqr(std::max(0.f, std::max(center.y - node.m_bounds.m_pMax.y,
-                node.m_bounds.m_pMin.y - center.y))) +
-            std::sqr(std::max(0.f, std::max(center.z - node.m_bounds.m_pMax.z,
-                node.m_bounds.m_pMin.z - center.z)));
-        if (minSqrDistance <= sqrRadius) {
-            if (SqrLength(center - photon.m_position) <= sqrRadius) {
-                photons.push_back(&photon);
-            }
-            if (node.m_children[0] != -1) {
-                stack.push(node.m_children[0]);
-            }
-            if (node.m_children[1] != -1) {
-                stack.push(node.m_children[1]);
-            }
+    uint32_t mid = l + LeftSubtreeSize(r - l);
+    int axis = bounds.MaxAxis();
+    std::nth_element(m_unsorted.begin() + l, m_unsorted.begin() + mid, m_unsorted.begin() + r,
+        [&](const Photon& p1, const Photon& p2)->bool {
+            return p1.m_position[axis] < p2.m_position[axis];
+        });
+    Photon& photon = m_photons[node] = m_unsorted[mid];
+    photon.SetAxis(axis);
+
+    Bounds lb, rb;
+    Split(bounds, axis, photon.m_position[axis], lb, rb);
+    auto buildLeft = [&]() {
+        if (mid > l) {
+            RecursiveBuild(2 * node + 1, l, mid, lb);
+        }
+    };
+    auto buildRight = [&]() {
+        if (r > mid + 1) {
+            RecursiveBuild(2 * node + 2, mid + 1, r, rb);
         }
+    };
+    if (r - l > parallel_build_size) {
+        tbb::parallel_invoke(buildLeft, buildRight);
+    }
+    else {
+        buildLeft();
+        buildRight();
     }
 }
 
-void KDTree::Query(const Float3& center, const float& radius, std::vector<Photon>& photons) const
+void KDTree::Build()
 {
-    if (m_photons.empty()) return;
-    float sqrRadius = std::sqr(radius);
-    std::stack<uint32_t> stack;
-    stack.push(m_root);
-    while (!stack.empty()) {
-        uint32_t idx = stack.top(); stack.pop();
-        const auto& node = m_nodes[idx];
-        const auto& photon = m_photons[node.m_photonIndex];
-        float minSqrDistance =
-            std::sqr(std::max(0.f, std::max(center.x - node.m_bounds.m_pMax.x,
-                node.m_bounds.m_pMin.x - center.x))) +
-            std::sqr(std::max(0.f, std::max(center.y - node.m_bounds.m_pMax.y,
-                node.m_bounds.m_pMin.y - center.y))) +
-            std::sqr(std::max(0.f, std::max(center.z - node.m_bounds.m_pMax.z,
-                node.m_bounds.m_pMin.z - center.z)));
-        if (minSqrDistance <= sqrRadius) {
-            if (SqrLength(center - photon.m_position) <= sqrRadius) {
-                photons.push_back(photon);
-            }
-            if (node.m_children[0] != -1) {
-                stack.push(node.m_children[0]);
-            }
-            if (node.m_children[1] != -1) {
-                stack.push(node.m_children[1]);
-            }
-        }
+    auto start = std::chrono::steady_clock::now();
+    // Photons kept since the last Clear() are rebuilt with the new ones
+    m_unsorted.assign(m_photons.begin(), m_photons.end());
+    m_buffers.Gather(m_unsorted, m_bounds);
+    m_photons.resize(m_unsorted.size());
+    if (!m_photons.empty()) {
+        RecursiveBuild(0, 0, m_photons.size(), m_bounds);
     }
+    m_buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
-bool IntersectSphere(const Float3& center, const float& radius, const Ray& ray, float* t) {
-    float a = SqrLength(ray.d);
-    float b = 2 * Dot(ray.o - center, ray.d);
-    float c = SqrLength(ray.o - center) - std::sqr(radius);
-
-    float t0, t1;
-    if (!math::SolveQuadratic(a, b, c, t0, t1)) return false;
-
-    *t = (t0 + t1) * 0.5f;
-    return (ray.tMin < *t) && (*t < ray.tMax);
-}
-
-void KDTree::QueryBeam(
-    const Ray& ray,
-    const float& radius,
-    std::vector<std::pair<const Photon*, float>>& photons) const
+void KDTree::Clear()
 {
-    if (m_photons.empty()) return;
-    std::stack<uint32_t> stack;
-    stack.push(m_root);
-    while (!stack.empty()) {
-        uint32_t idx = stack.top(); stack.pop();
-        const auto& node = m_nodes[idx];
-        const auto& photon = m_photons[node.m_photonIndex];
-        // Check ray intersect bounds
-        if (node.m_bounds.Intersect(ray)) {
-            // Check the beam contain the photon
-            float t;
-            if (IntersectSphere(photon.m_position, radius, ray, &t)) {
-                photons.push_back(std::make_pair(&photon, t));
-            }
-            // Add children nodes
-            if (node.m_children[0] != -1) {
-                stack.push(node.m_children[0]);
-            }
-            if (node.m_children[1] != -1) {
-                stack.push(node.m_children[1]);
-            }
-        }
-    }
+    m_photons.clear();
+    m_bounds = Bounds();
+    m_buffers.Clear();
 }
@@ -3,52 +3,219 @@
 #include "core/vector.h"
 #include "core/spectrum.h"
 
+#include <tbb/enumerable_thread_specific.h>
+
 #include <atomic>
 #include <thread>
 #include <mutex>
 
+// 20 byte photon: position, shared exponent (RGBE) flux, 8 + 8 bit
+// octahedral direction and the split axis of its KD-tree node
 struct Photon {
+    Photon() {}
     Photon(const Float3& p, const Float3& d, const Spectrum& f)
-        :m_position(p), m_direction(d), m_flux(f) {}
+        :m_position(p), m_flags(0)
+    {
+        SetDirection(d);
+        SetFlux(f);
+    }
+
+    Float3 Direction() const {
+        float x = (m_direction & 0xff) * (2.f / 255) - 1;
+        float y = (m_direction >> 8) * (2.f / 255) - 1;
+        float z = 1 - std::fabs(x) - std::fabs(y);
+        if (z < 0) {
+            float fx = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+            y = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+            x = fx;
+        }
+        return Normalize(Float3(x, y, z));
+    }
+    void SetDirection(const Float3& d) {
+        float invL1 = 1.f / (std::fabs(d.x) + std::fabs(d.y) + std::fabs(d.z));
+        float x = d.x * invL1, y = d.y * invL1;
+        if (d.z < 0) {
+            float fx = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+            y = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+            x = fx;
+        }
+        uint32_t qx = uint32_t(std::round((x * .5f + .5f) * 255));
+        uint32_t qy = uint32_t(std::round((y * .5f + .5f) * 255));
+        m_direction = uint16_t(qx | (qy << 8));
+    }
+
+    Spectrum Flux() const {
+        if (m_flux[3] == 0) {
+            return Spectrum(0.f);
+        }
+        float scale = std::ldexp(1.f, int(m_flux[3]) - (128 + 8));
+        return Spectrum(m_flux[0] * scale, m_flux[1] * scale, m_flux[2] * scale);
+    }
+    void SetFlux(const Spectrum& f) {
+        float maxValue = MaxComponent(f);
+        if (maxValue < 1e-32f) {
+            m_flux[0] = m_flux[1] = m_flux[2] = m_flux[3] = 0;
+            return;
+        }
+        int exponent;
+        std::frexp(maxValue, &exponent);
+        float scale = std::ldexp(1.f, 8 - exponent);
+        for (int c = 0; c < 3; c++) {
+            m_flux[c] = uint8_t(std::min(255.f, std::max(0.f, f[c]) * scale + .5f));
+        }
+        m_flux[3] = uint8_t(exponent + 128);
+    }
+
+    uint32_t Axis() const { return m_flags & 3; }
+    void SetAxis(const uint32_t& axis) { m_flags = uint16_t((m_flags & ~3u) | axis); }
 
     Float3 m_position;
-    Float3 m_direction;
-    Spectrum m_flux;
+    uint8_t m_flux[4];
+    uint16_t m_direction;
+    uint16_t m_flags;
 };
+static_assert(sizeof(Photon) == 20, "Photon is expected to be 20 bytes");
 
-struct KDTreeNode {
-    KDTreeNode(const Bounds& bounds, int axis, int lc, int rc, uint32_t photonIndex)
-        :m_bounds(bounds), m_axis(axis), m_children{ lc, rc }, m_photonIndex(photonIndex) {}
-    KDTreeNode(const KDTreeNode& node)
-        :m_bounds(node.m_bounds), m_axis(node.m_axis), m_children(node.m_children),
-        m_photonIndex(node.m_photonIndex) {}
+enum class PhotonMapType {
+    KDTree,
+    HashGrid
+};
 
-    Bounds m_bounds;
-    int m_axis;
-    std::array<int, 2> m_children;
+// Photons deposited without locking, every thread appends to its own buffer
+class PhotonBuffers {
+public:
+    void Add(const Photon& photon) {
+        Buffer& buffer = m_buffers.local();
+        buffer.m_photons.push_back(photon);
+        buffer.m_bounds = Union(buffer.m_bounds, Bounds(photon.m_position));
+    }
+    // Appends all buffered photons to _photons_ and grows _bounds_
+    void Gather(std::vector<Photon>& photons, Bounds& bounds);
+    void Clear();
 
-    uint32_t m_photonIndex;
+private:
+    struct Buffer {
+        std::vector<Photon> m_photons;
+        Bounds m_bounds;
+    };
+    tbb::enumerable_thread_specific<Buffer> m_buffers;
 };
 
+// Left-balanced KD-tree stored implicitly in m_photons, the children of
+// photon i are 2i + 1 and 2i + 2 and the split axis lives in the photon
 class KDTree {
 public:
-    void Add(const Photon& photon);
-    void Build(const float& radius = 0);
-    void Clear();
+    // Largest k of QueryKNN(), its heap lives on the stack
+    static constexpr uint32_t max_knn = 256;
 
-    void Query(const Float3& center, const float& radius, std::vector<const Photon*>& photons) const;
-    void Query(const Float3& center, const float& radius, std::vector<Photon>& photons) const;
-    void QueryBeam(
-        const Ray& ray, 
-        const float& radius, 
-        std::vector<std::pair<const Photon*, float>>& photons) const; 
+    // Thread safe, photons go to a per-thread buffer until Build()
+    void Add(const Photon& photon) { m_buffers.Add(photon); }
+    void Build();
+    void Clear();
 
-    uint32_t RecursiveBuild(uint32_t l, uint32_t r, Bounds& bounds, const float& radius);
+    // Calls _visitor_(photon) for every photon within _radius_ of _center_
+    template<typename Visitor>
+    void Query(const Float3& center, const float& radius, Visitor visitor) const;
+    // Calls _visitor_(photon) for the _k_ nearest photons within _maxRadius_ of
+    // _center_, returns the squared radius of that neighbourhood
+    template<typename Visitor>
+    float QueryKNN(const Float3& center, const uint32_t& k, const float& maxRadius, Visitor visitor) const;
 
-    uint32_t m_root;
+    // Heap ordered after Build()
     std::vector<Photon> m_photons;
-    std::vector<KDTreeNode> m_nodes;
-
-    std::mutex m_mutex;
     Bounds m_bounds;
-};
\ No newline at end of file
+    // Milliseconds spent in the last Build()
+    float m_buildTime = 0;
+
+private:
+    void RecursiveBuild(const uint32_t& node, const uint32_t& l, const uint32_t& r, const Bounds& bounds);
+
+    std::vector<Photon> m_unsorted;
+    PhotonBuffers m_buffers;
+};
+
+template<typename Visitor>
+void KDTree::Query(const Float3& center, const float& radius, Visitor visitor) const
+{
+    uint32_t photonNum = m_photons.size();
+    if (photonNum == 0) {
+        return;
+    }
+    float sqrRadius = std::sqr(radius);
+    // At most one far child per level waits on the stack
+    uint32_t stack[64];
+    uint32_t top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        uint32_t idx = stack[--top];
+        const Photon& photon = m_photons[idx];
+        if (SqrLength(center - photon.m_position) <= sqrRadius) {
+            visitor(photon);
+        }
+        uint32_t axis = photon.Axis();
+        float d = center[axis] - photon.m_position[axis];
+        uint32_t nearChild = d < 0 ? 2 * idx + 1 : 2 * idx + 2;
+        uint32_t farChild = d < 0 ? 2 * idx + 2 : 2 * idx + 1;
+        if (farChild < photonNum && d * d <= sqrRadius) {
+            stack[top++] = farChild;
+        }
+        if (nearChild < photonNum) {
+            stack[top++] = nearChild;
+        }
+    }
+}
+
+template<typename Visitor>
+float KDTree::QueryKNN(const Float3& center, const uint32_t& k, const float& maxRadius, Visitor visitor) const
+{
+    float sqrRadius = std::sqr(maxRadius);
+    uint32_t photonNum = m_photons.size();
+    if (photonNum == 0 || k == 0) {
+        return sqrRadius;
+    }
+    uint32_t maxNum = std::min(k, max_knn);
+    // Max-heap of (squared distance, photon), once full its top bounds the search
+    std::pair<float, uint32_t> heap[max_knn];
+    uint32_t heapNum = 0;
+    // Nodes wait with the squared distance to their splitting plane
+    std::pair<uint32_t, float> stack[64];
+    uint32_t top = 0;
+    stack[top++] = std::make_pair(0u, 0.f);
+    while (top > 0) {
+        --top;
+        if (stack[top].second > sqrRadius) {
+            continue;
+        }
+        uint32_t idx = stack[top].first;
+        const Photon& photon = m_photons[idx];
+        float sqrDistance = SqrLength(center - photon.m_position);
+        if (sqrDistance <= sqrRadius) {
+            if (heapNum < maxNum) {
+                heap[heapNum++] = std::make_pair(sqrDistance, idx);
+                std::push_heap(heap, heap + heapNum);
+            }
+            else {
+                std::pop_heap(heap, heap + heapNum);
+                heap[heapNum - 1] = std::make_pair(sqrDistance, idx);
+                std::push_heap(heap, heap + heapNum);
+            }
+            if (heapNum == maxNum) {
+                sqrRadius = heap[0].first;
+            }
+        }
+        uint32_t axis = photon.Axis();
+        float d = center[axis] - photon.m_position[axis];
+        uint32_t nearChild = d < 0 ? 2 * idx + 1 : 2 * idx + 2;
+        uint32_t farChild = d < 0 ? 2 * idx + 2 : 2 * idx + 1;
+        if (farChild < photonNum && d * d <= sqrRadius) {
+            stack[top++] = std::make_pair(farChild, d * d);
+        }
+        if (nearChild < photonNum) {
+            stack[top++] = std::make_pair(nearChild, 0.f);
+        }
+    }
+    for (uint32_t i = 0; i < heapNum; i++) {
+        visitor(m_photons[heap[i].second]);
+    }
+    return sqrRadius;
+}
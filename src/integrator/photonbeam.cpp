@@ -0,0 +1,131 @@
+#include "photonbeam.h"
+
+#include <tbb/parallel_invoke.h>
+
+#include <chrono>
+
+#define BIN_NUM 16
+// Deeper nodes split at the median so the traversal stack cannot overflow
+#define SAH_MAX_DEPTH 64
+
+// Subtrees smaller than this are built serially
+static constexpr uint32_t parallel_build_size = 4096;
+
+void PhotonBeamBVH::RecursiveBuild(const uint32_t& nodeIdx, const uint32_t& l, const uint32_t& r, const uint32_t& depth)
+{
+    Bounds bounds, centroidBounds;
+    for (uint32_t i = l; i < r; i++) {
+        Bounds beamBounds = BeamBounds(m_beams[i]);
+        bounds = Union(bounds, beamBounds);
+        centroidBounds = Union(centroidBounds, Bounds(beamBounds.Centroid()));
+    }
+    Node& node = m_nodes[nodeIdx];
+    node.m_bounds = bounds;
+
+    uint32_t beamNum = r - l;
+    if (beamNum <= leaf_size) {
+        node.m_offset = l;
+        node.m_count = beamNum;
+        return;
+    }
+
+    int axis = centroidBounds.MaxAxis();
+    float axisMin = centroidBounds.m_pMin[axis];
+    float extent = centroidBounds.m_pMax[axis] - axisMin;
+    uint32_t mid = l;
+    if (extent > 0 && depth < SAH_MAX_DEPTH) {
+        // Binned SAH over the centroids of the grown beam bounds
+        auto binOf = [&](const PhotonBeam& beam) {
+            int b = int((BeamBounds(beam).Centroid()[axis] - axisMin) / extent * BIN_NUM);
+            return std::min(std::max(b, 0), BIN_NUM - 1);
+        };
+        uint32_t counts[BIN_NUM] = {};
+        Bounds bins[BIN_NUM];
+        for (uint32_t i = l; i < r; i++) {
+            int b = binOf(m_beams[i]);
+            counts[b]++;
+            bins[b] = Union(bins[b], BeamBounds(m_beams[i]));
+        }
+        float rightCosts[BIN_NUM];
+        Bounds rightBounds;
+        uint32_t rightNum = 0;
+        for (int b = BIN_NUM - 1; b > 0; b--) {
+            if (counts[b] > 0) {
+                rightBounds = Union(rightBounds, bins[b]);
+                rightNum += counts[b];
+            }
+            rightCosts[b] = rightNum > 0 ? rightNum * rightBounds.Area() : 0;
+        }
+        Bounds leftBounds;
+        uint32_t leftNum = 0;
+        float minCost = std::numeric_limits<float>::max();
+        int minBin = -1;
+        for (int b = 0; b < BIN_NUM - 1; b++) {
+            if (counts[b] > 0) {
+                leftBounds = Union(leftBounds, bins[b]);
+                leftNum += counts[b];
+            }
+            if (leftNum == 0 || leftNum == beamNum) {
+                continue;
+            }
+            float cost = leftNum * leftBounds.Area() + rightCosts[b + 1];
+            if (cost < minCost) {
+                minCost = cost;
+                minBin = b;
+            }
+        }
+        if (minBin >= 0) {
+            mid = std::partition(m_beams.begin() + l, m_beams.begin() + r,
+                [&](const PhotonBeam& beam) { return binOf(beam) <= minBin; }) - m_beams.begin();
+        }
+    }
+    if (mid == l || mid == r) {
+        // Coincident beams or a deep subtree, split at the median
+        mid = (l + r) / 2;
+        std::nth_element(m_beams.begin() + l, m_beams.begin() + mid, m_beams.begin() + r,
+            [&](const PhotonBeam& b1, const PhotonBeam& b2)->bool {
+                return BeamBounds(b1).Centroid()[axis] < BeamBounds(b2).Centroid()[axis];
+            });
+    }
+
+    uint32_t child = m_nodeNum.fetch_add(2);
+    node.m_offset = child;
+    node.m_count = 0;
+    auto buildLeft = [&]() { RecursiveBuild(child, l, mid, depth + 1); };
+    auto buildRight = [&]() { RecursiveBuild(child + 1, mid, r, depth + 1); };
+    if (beamNum > parallel_build_size) {
+        tbb::parallel_invoke(buildLeft, buildRight);
+    }
+    else {
+        buildLeft();
+        buildRight();
+    }
+}
+
+void PhotonBeamBVH::Build(const float& radius)
+{
+    auto start = std::chrono::steady_clock::now();
+    m_radius = radius;
+    // Beams kept since the last Clear() are rebuilt with the new ones
+    for (std::vector<PhotonBeam>& buffer : m_buffers) {
+        m_beams.insert(m_beams.end(), buffer.begin(), buffer.end());
+        buffer.clear();
+    }
+    uint32_t beamNum = m_beams.size();
+    m_nodes.resize(std::max(2 * beamNum, 1u));
+    m_nodeNum = 1;
+    if (beamNum > 0) {
+        RecursiveBuild(0, 0, beamNum, 0);
+    }
+    m_nodes.resize(m_nodeNum);
+    m_buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void PhotonBeamBVH::Clear()
+{
+    m_beams.clear();
+    m_nodes.clear();
+    for (std::vector<PhotonBeam>& buffer : m_buffers) {
+        buffer.clear();
+    }
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "photon.h"
+
+// Medium segment of a photon path, from where it entered the segment to the
+// sampled collision or the surface. Collisions are sampled with the channel
+// averaged pdf, so the photon reaches distance t with probability
+// Tr(t).Average() and carries flux * Tr(t) / Tr(t).Average() there. The flux
+// is only constant along the beam for gray sigma_t. Media with varying
+// sigma_t are gray here, so the sigma_t at the start is enough.
+struct PhotonBeam {
+    PhotonBeam() {}
+    PhotonBeam(const Float3& start, const Float3& d, const float& length, const Spectrum& flux, const Spectrum& sigmaT)
+        :m_start(start), m_direction(d), m_length(length), m_flux(flux), m_sigmaT(sigmaT) {}
+
+    // Flux at distance _t_ from the start
+    Spectrum Flux(const float& t) const {
+        // Relative to the smallest sigma_t so gray beams stay exact at any depth
+        float sigmaMin = std::min(m_sigmaT.r, std::min(m_sigmaT.g, m_sigmaT.b));
+        Spectrum Tr = Exp((m_sigmaT - Spectrum(sigmaMin)) * (-t));
+        return m_flux * Tr / Tr.Average();
+    }
+
+    Float3 m_start;
+    Float3 m_direction;
+    float m_length;
+    // Flux entering the beam
+    Spectrum m_flux;
+    Spectrum m_sigmaT;
+};
+
+// SAH BVH over photon beams grown by a fixed radius, leaves hold up to 4
+// beams and children are stored next to each other
+class PhotonBeamBVH {
+public:
+    static constexpr uint32_t leaf_size = 4;
+
+    // Thread safe, beams go to a per-thread buffer until Build()
+    void Add(const PhotonBeam& beam) { m_buffers.local().push_back(beam); }
+    void Build(const float& radius);
+    void Clear();
+
+    // Calls _visitor_(beam, tCamera, tBeam, sinTheta) for every beam passing
+    // within the radius of the ray inside [tMin, tMax]. tCamera and tBeam are
+    // the distances of closest approach along the ray and the beam, sinTheta
+    // the sine between both lines
+    template<typename Visitor>
+    void QueryBeam(const Ray& ray, Visitor visitor) const;
+    // Calls _visitor_(beam, t) for every beam within the radius of _center_,
+    // t is the distance of the projected center along the beam
+    template<typename Visitor>
+    void Query(const Float3& center, Visitor visitor) const;
+
+    // Leaf order after Build()
+    std::vector<PhotonBeam> m_beams;
+    float m_radius = 0;
+    // Milliseconds spent in the last Build()
+    float m_buildTime = 0;
+
+private:
+    struct Node {
+        // Bounds of the grown beams below the node
+        Bounds m_bounds;
+        // First child for inner nodes, first beam for leaves
+        uint32_t m_offset;
+        // Beams in a leaf, 0 for inner nodes
+        uint32_t m_count;
+    };
+
+    void RecursiveBuild(const uint32_t& nodeIdx, const uint32_t& l, const uint32_t& r, const uint32_t& depth);
+    Bounds BeamBounds(const PhotonBeam& beam) const {
+        Bounds bounds = Union(Bounds(beam.m_start), Bounds(beam.m_start + beam.m_direction * beam.m_length));
+        return Bounds(bounds.m_pMin - Float3(m_radius), bounds.m_pMax + Float3(m_radius));
+    }
+    // Traverses the nodes accepted by _overlap_(bounds), leaves go to _leaf_(offset, count)
+    template<typename Overlap, typename Leaf>
+    void Traverse(Overlap overlap, Leaf leaf) const;
+
+    std::vector<Node> m_nodes;
+    std::atomic<uint32_t> m_nodeNum;
+    tbb::enumerable_thread_specific<std::vector<PhotonBeam>> m_buffers;
+};
+
+template<typename Overlap, typename Leaf>
+void PhotonBeamBVH::Traverse(Overlap overlap, Leaf leaf) const
+{
+    if (m_beams.empty() || !overlap(m_nodes[0].m_bounds)) {
+        return;
+    }
+    uint32_t stack[128];
+    uint32_t top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = m_nodes[stack[--top]];
+        if (node.m_count > 0) {
+            leaf(node.m_offset, node.m_count);
+            continue;
+        }
+        for (uint32_t child = node.m_offset; child < node.m_offset + 2; child++) {
+            if (overlap(m_nodes[child].m_bounds)) {
+                stack[top++] = child;
+            }
+        }
+    }
+}
+
+template<typename Visitor>
+void PhotonBeamBVH::QueryBeam(const Ray& ray, Visitor visitor) const
+{
+    auto overlap = [&](const Bounds& bounds) { return bounds.Intersect(ray); };
+    float sqrRadius = std::sqr(m_radius);
+    Traverse(overlap, [&](const uint32_t& offset, const uint32_t& count) {
+        for (uint32_t i = offset; i < offset + count; i++) {
+            // Closest points of the two lines, both directions are unit length
+            const PhotonBeam& beam = m_beams[i];
+            Float3 w0 = ray.o - beam.m_start;
+            float b = Dot(ray.d, beam.m_direction);
+            float sqrSinTheta = 1 - b * b;
+            if (sqrSinTheta < 1e-6f) {
+                continue;
+            }
+            float d = Dot(ray.d, w0), e = Dot(beam.m_direction, w0);
+            float tCamera = (b * e - d) / sqrSinTheta;
+            float tBeam = (e - b * d) / sqrSinTheta;
+            if (tCamera <= ray.tMin || tCamera >= ray.tMax || tBeam < 0 || tBeam > beam.m_length) {
+                continue;
+            }
+            if (SqrLength(w0 + ray.d * tCamera - beam.m_direction * tBeam) <= sqrRadius) {
+                visitor(beam, tCamera, tBeam, std::sqrt(sqrSinTheta));
+            }
+        }
+    });
+}
+
+template<typename Visitor>
+void PhotonBeamBVH::Query(const Float3& center, Visitor visitor) const
+{
+    auto overlap = [&](const Bounds& bounds) { return bounds.Contain(center); };
+    float sqrRadius = std::sqr(m_radius);
+    Traverse(overlap, [&](const uint32_t& offset, const uint32_t& count) {
+        for (uint32_t i = offset; i < offset + count; i++) {
+            // Perpendicular distance, the projection must fall on the segment
+            const PhotonBeam& beam = m_beams[i];
+            Float3 w0 = center - beam.m_start;
+            float t = Dot(w0, beam.m_direction);
+            if (t < 0 || t > beam.m_length) {
+                continue;
+            }
+            if (SqrLength(w0 - beam.m_direction * t) <= sqrRadius) {
+                visitor(beam, t);
+            }
+        }
+    });
+}
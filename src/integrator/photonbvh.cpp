@@ -0,0 +1,145 @@
+#include "photonbvh.h"
+
+#include <tbb/parallel_invoke.h>
+
+#include <chrono>
+
+#define BIN_NUM 16
+// Below this depth SAH splits may be lopsided, deeper nodes split at the
+// median so the traversal stack of 128 entries cannot overflow
+#define SAH_MAX_DEPTH 64
+
+// Subtrees smaller than this are built serially
+static constexpr uint32_t parallel_build_size = 16384;
+
+// Surface area of the centroid bounds grown by the photon radius
+static float GrownArea(const Bounds& bounds, const float& radius)
+{
+    Float3 d = bounds.m_pMax - bounds.m_pMin + Float3(2 * radius);
+    return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+void PhotonBVH::RecursiveBuild(const uint32_t& nodeIdx, const uint32_t& l, const uint32_t& r, const uint32_t& depth)
+{
+    Bounds centroidBounds;
+    for (uint32_t i = l; i < r; i++) {
+        centroidBounds = Union(centroidBounds, Bounds(m_photons[i].m_position));
+    }
+    Node& node = m_nodes[nodeIdx];
+    node.m_bounds = Bounds(centroidBounds.m_pMin - Float3(m_radius), centroidBounds.m_pMax + Float3(m_radius));
+
+    uint32_t photonNum = r - l;
+    if (photonNum <= leaf_size) {
+        uint32_t packetIdx = m_packetNum.fetch_add(1);
+        Packet& packet = m_packets[packetIdx];
+        for (uint32_t k = 0; k < leaf_size; k++) {
+            // Unused lanes repeat the first photon and are masked out
+            const Float3& p = m_photons[l + (k < photonNum ? k : 0)].m_position;
+            packet.m_x[k] = p.x;
+            packet.m_y[k] = p.y;
+            packet.m_z[k] = p.z;
+        }
+        packet.m_start = l;
+        node.m_offset = packetIdx;
+        node.m_count = photonNum;
+        return;
+    }
+
+    int axis = centroidBounds.MaxAxis();
+    float axisMin = centroidBounds.m_pMin[axis];
+    float extent = centroidBounds.m_pMax[axis] - axisMin;
+    uint32_t mid = l;
+    if (extent > 0 && depth < SAH_MAX_DEPTH) {
+        // Binned SAH over the centroids
+        auto binOf = [&](const Photon& photon) {
+            int b = int((photon.m_position[axis] - axisMin) / extent * BIN_NUM);
+            return std::min(std::max(b, 0), BIN_NUM - 1);
+        };
+        uint32_t counts[BIN_NUM] = {};
+        Bounds bins[BIN_NUM];
+        for (uint32_t i = l; i < r; i++) {
+            int b = binOf(m_photons[i]);
+            counts[b]++;
+            bins[b] = Union(bins[b], Bounds(m_photons[i].m_position));
+        }
+        float rightCosts[BIN_NUM];
+        Bounds rightBounds;
+        uint32_t rightNum = 0;
+        for (int b = BIN_NUM - 1; b > 0; b--) {
+            if (counts[b] > 0) {
+                rightBounds = Union(rightBounds, bins[b]);
+                rightNum += counts[b];
+            }
+            rightCosts[b] = rightNum > 0 ? rightNum * GrownArea(rightBounds, m_radius) : 0;
+        }
+        Bounds leftBounds;
+        uint32_t leftNum = 0;
+        float minCost = std::numeric_limits<float>::max();
+        int minBin = -1;
+        for (int b = 0; b < BIN_NUM - 1; b++) {
+            if (counts[b] > 0) {
+                leftBounds = Union(leftBounds, bins[b]);
+                leftNum += counts[b];
+            }
+            if (leftNum == 0 || leftNum == photonNum) {
+                continue;
+            }
+            float cost = leftNum * GrownArea(leftBounds, m_radius) + rightCosts[b + 1];
+            if (cost < minCost) {
+                minCost = cost;
+                minBin = b;
+            }
+        }
+        if (minBin >= 0) {
+            mid = std::partition(m_photons.begin() + l, m_photons.begin() + r,
+                [&](const Photon& photon) { return binOf(photon) <= minBin; }) - m_photons.begin();
+        }
+    }
+    if (mid == l || mid == r) {
+        // Coincident photons or a deep subtree, split at the median
+        mid = (l + r) / 2;
+        std::nth_element(m_photons.begin() + l, m_photons.begin() + mid, m_photons.begin() + r,
+            [&](const Photon& p1, const Photon& p2)->bool {
+                return p1.m_position[axis] < p2.m_position[axis];
+            });
+    }
+
+    uint32_t child = m_nodeNum.fetch_add(2);
+    node.m_offset = child;
+    node.m_count = 0;
+    auto buildLeft = [&]() { RecursiveBuild(child, l, mid, depth + 1); };
+    auto buildRight = [&]() { RecursiveBuild(child + 1, mid, r, depth + 1); };
+    if (photonNum > parallel_build_size) {
+        tbb::parallel_invoke(buildLeft, buildRight);
+    }
+    else {
+        buildLeft();
+        buildRight();
+    }
+}
+
+void PhotonBVH::Build(const std::vector<Photon>& photons, const float& radius)
+{
+    auto start = std::chrono::steady_clock::now();
+    m_radius = radius;
+    m_photons.assign(photons.begin(), photons.end());
+    uint32_t photonNum = m_photons.size();
+    // A binary tree with n leaves has 2n - 1 nodes
+    m_nodes.resize(std::max(2 * photonNum, 1u));
+    m_packets.resize(photonNum);
+    m_nodeNum = 1;
+    m_packetNum = 0;
+    if (photonNum > 0) {
+        RecursiveBuild(0, 0, photonNum, 0);
+    }
+    m_nodes.resize(m_nodeNum);
+    m_packets.resize(m_packetNum);
+    m_buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void PhotonBVH::Clear()
+{
+    m_photons.clear();
+    m_nodes.clear();
+    m_packets.clear();
+}
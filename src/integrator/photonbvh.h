@@ -0,0 +1,141 @@
+#pragma once
+
+#include "photon.h"
+
+#include <immintrin.h>
+
+// SAH BVH over fixed radius photon spheres for beam radiance estimates.
+// Leaves hold up to 4 photons stored as an SSE packet, so the ray-sphere
+// tests of a leaf are done at once. Children are stored next to each other.
+class PhotonBVH {
+public:
+    static constexpr uint32_t leaf_size = 4;
+
+    void Build(const std::vector<Photon>& photons, const float& radius);
+    void Clear();
+
+    // Calls _visitor_(photon, t) for every photon whose sphere the ray passes
+    // through within [tMin, tMax], t is the distance of closest approach
+    template<typename Visitor>
+    void QueryBeam(const Ray& ray, Visitor visitor) const;
+
+    // Leaf order after Build()
+    std::vector<Photon> m_photons;
+    float m_radius = 0;
+    // Milliseconds spent in the last Build()
+    float m_buildTime = 0;
+
+private:
+    struct Node {
+        // Bounds of the photon spheres below the node
+        Bounds m_bounds;
+        // First child for inner nodes, packet for leaves
+        uint32_t m_offset;
+        // Photons in a leaf, 0 for inner nodes
+        uint32_t m_count;
+    };
+    struct alignas(16) Packet {
+        float m_x[leaf_size], m_y[leaf_size], m_z[leaf_size];
+        uint32_t m_start;
+    };
+
+    void RecursiveBuild(const uint32_t& nodeIdx, const uint32_t& l, const uint32_t& r, const uint32_t& depth);
+    // Slab test against [tMin, tMax], _tNear_ is the entry distance
+    static bool IntersectNode(
+        const Node& node,
+        const __m128& o,
+        const __m128& invD,
+        const float& tMin,
+        const float& tMax,
+        float& tNear)
+    {
+        __m128 pMin = _mm_set_ps(0, node.m_bounds.m_pMin.z, node.m_bounds.m_pMin.y, node.m_bounds.m_pMin.x);
+        __m128 pMax = _mm_set_ps(0, node.m_bounds.m_pMax.z, node.m_bounds.m_pMax.y, node.m_bounds.m_pMax.x);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(pMin, o), invD);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(pMax, o), invD);
+        alignas(16) float tEnter[4], tExit[4];
+        _mm_store_ps(tEnter, _mm_min_ps(t0, t1));
+        _mm_store_ps(tExit, _mm_max_ps(t0, t1));
+        tNear = std::max(std::max(tEnter[0], tEnter[1]), std::max(tEnter[2], tMin));
+        float tFar = std::min(std::min(tExit[0], tExit[1]), std::min(tExit[2], tMax));
+        return tNear <= tFar;
+    }
+
+    std::vector<Node> m_nodes;
+    std::vector<Packet> m_packets;
+    std::atomic<uint32_t> m_nodeNum;
+    std::atomic<uint32_t> m_packetNum;
+};
+
+template<typename Visitor>
+void PhotonBVH::QueryBeam(const Ray& ray, Visitor visitor) const
+{
+    if (m_packets.empty()) {
+        return;
+    }
+    __m128 o = _mm_set_ps(0, ray.o.z, ray.o.y, ray.o.x);
+    __m128 invD = _mm_set_ps(1, 1.f / ray.d.z, 1.f / ray.d.y, 1.f / ray.d.x);
+    __m128 ox = _mm_set1_ps(ray.o.x), oy = _mm_set1_ps(ray.o.y), oz = _mm_set1_ps(ray.o.z);
+    __m128 dx = _mm_set1_ps(ray.d.x), dy = _mm_set1_ps(ray.d.y), dz = _mm_set1_ps(ray.d.z);
+    __m128 invDD = _mm_set1_ps(1.f / Dot(ray.d, ray.d));
+    __m128 sqrRadius = _mm_set1_ps(m_radius * m_radius);
+    __m128 tMin = _mm_set1_ps(ray.tMin), tMax = _mm_set1_ps(ray.tMax);
+
+    float tNear0, tNear1;
+    if (!IntersectNode(m_nodes[0], o, invD, ray.tMin, ray.tMax, tNear0)) {
+        return;
+    }
+    uint32_t stack[128];
+    uint32_t top = 0;
+    uint32_t idx = 0;
+    while (true) {
+        const Node& node = m_nodes[idx];
+        if (node.m_count == 0) {
+            // Front to back, the far child waits on the stack
+            uint32_t near = node.m_offset, far = node.m_offset + 1;
+            bool hit0 = IntersectNode(m_nodes[near], o, invD, ray.tMin, ray.tMax, tNear0);
+            bool hit1 = IntersectNode(m_nodes[far], o, invD, ray.tMin, ray.tMax, tNear1);
+            if (hit0 && hit1) {
+                if (tNear1 < tNear0) {
+                    std::swap(near, far);
+                }
+                stack[top++] = far;
+                idx = near;
+                continue;
+            }
+            if (hit0 || hit1) {
+                idx = hit0 ? near : far;
+                continue;
+            }
+        }
+        else {
+            // Closest approach of the ray to 4 photons at once
+            const Packet& packet = m_packets[node.m_offset];
+            __m128 px = _mm_sub_ps(_mm_load_ps(packet.m_x), ox);
+            __m128 py = _mm_sub_ps(_mm_load_ps(packet.m_y), oy);
+            __m128 pz = _mm_sub_ps(_mm_load_ps(packet.m_z), oz);
+            __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, dx), _mm_mul_ps(py, dy)),
+                _mm_mul_ps(pz, dz)), invDD);
+            __m128 qx = _mm_sub_ps(px, _mm_mul_ps(dx, t));
+            __m128 qy = _mm_sub_ps(py, _mm_mul_ps(dy, t));
+            __m128 qz = _mm_sub_ps(pz, _mm_mul_ps(dz, t));
+            __m128 sqrDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)), _mm_mul_ps(qz, qz));
+            __m128 mask = _mm_and_ps(_mm_cmple_ps(sqrDistance, sqrRadius),
+                _mm_and_ps(_mm_cmpgt_ps(t, tMin), _mm_cmplt_ps(t, tMax)));
+            int bits = _mm_movemask_ps(mask) & ((1 << node.m_count) - 1);
+            if (bits) {
+                alignas(16) float ts[leaf_size];
+                _mm_store_ps(ts, t);
+                for (uint32_t k = 0; k < node.m_count; k++) {
+                    if (bits & (1 << k)) {
+                        visitor(m_photons[packet.m_start + k], ts[k]);
+                    }
+                }
+            }
+        }
+        if (top == 0) {
+            break;
+        }
+        idx = stack[--top];
+    }
+}
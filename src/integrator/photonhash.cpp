@@ -0,0 +1,121 @@
+#include "photonhash.h"
+
+#include "pcg32/pcg32.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include <chrono>
+
+void PhotonHashGrid::Build(const float& radius)
+{
+    LOG_IF(FATAL, radius <= 0) << "Photon hash grid needs a positive radius";
+    auto start = std::chrono::steady_clock::now();
+    // Photons kept since the last Clear() are sorted again with the new ones
+    m_unsorted.assign(m_photons.begin(), m_photons.end());
+    m_buffers.Gather(m_unsorted, m_bounds);
+    uint32_t photonNum = m_unsorted.size();
+    m_invCellSize = 1.f / (2 * radius);
+    uint32_t tableSize = 1;
+    while (tableSize < 2 * photonNum) {
+        tableSize <<= 1;
+    }
+    m_tableMask = tableSize - 1;
+
+    // Count photons per hash
+    std::vector<std::atomic<uint32_t>> cursors(tableSize);
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, tableSize),
+        [&](const tbb::blocked_range<uint32_t>& range) {
+            for (uint32_t h = range.begin(); h < range.end(); h++) {
+                cursors[h].store(0, std::memory_order_relaxed);
+            }
+        });
+    m_hashes.resize(photonNum);
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, photonNum),
+        [&](const tbb::blocked_range<uint32_t>& range) {
+            for (uint32_t i = range.begin(); i < range.end(); i++) {
+                m_hashes[i] = Hash(Cell(m_unsorted[i].m_position));
+                cursors[m_hashes[i]].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+
+    // Exclusive prefix sum, the counters become write cursors
+    m_cellStart.resize(tableSize + 1);
+    m_cellStart[0] = 0;
+    for (uint32_t h = 0; h < tableSize; h++) {
+        uint32_t count = cursors[h].load(std::memory_order_relaxed);
+        cursors[h].store(m_cellStart[h], std::memory_order_relaxed);
+        m_cellStart[h + 1] = m_cellStart[h] + count;
+    }
+
+    m_photons.resize(photonNum);
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, photonNum),
+        [&](const tbb::blocked_range<uint32_t>& range) {
+            for (uint32_t i = range.begin(); i < range.end(); i++) {
+                uint32_t dst = cursors[m_hashes[i]].fetch_add(1, std::memory_order_relaxed);
+                m_photons[dst] = m_unsorted[i];
+            }
+        });
+    m_buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void PhotonHashGrid::Clear()
+{
+    m_photons.clear();
+    m_cellStart.clear();
+    m_bounds = Bounds();
+    m_buffers.Clear();
+}
+
+void BenchmarkPhotonMaps(const std::vector<Photon>& photons, const float& radius)
+{
+    if (photons.empty()) {
+        return;
+    }
+    KDTree tree;
+    PhotonHashGrid grid;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, photons.size()),
+        [&](const tbb::blocked_range<size_t>& range) {
+            for (size_t i = range.begin(); i < range.end(); i++) {
+                tree.Add(photons[i]);
+                grid.Add(photons[i]);
+            }
+        });
+    tree.Build();
+    grid.Build(radius);
+
+    // Queries around jittered photon positions, like gather points on lit surfaces
+    const uint32_t queryNum = 1 << 18;
+    std::vector<Float3> centers(queryNum);
+    pcg32 rng;
+    for (Float3& center : centers) {
+        const Photon& photon = photons[rng.nextUInt(photons.size())];
+        center = photon.m_position +
+            (Float3(rng.nextFloat(), rng.nextFloat(), rng.nextFloat()) - Float3(.5f)) * radius;
+    }
+
+    auto run = [&](const std::string& name, const float& buildTime, auto query) {
+        std::atomic<uint64_t> found(0);
+        auto start = std::chrono::steady_clock::now();
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, queryNum),
+            [&](const tbb::blocked_range<uint32_t>& range) {
+                uint64_t num = 0;
+                for (uint32_t i = range.begin(); i < range.end(); i++) {
+                    query(centers[i], num);
+                }
+                found += num;
+            });
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        std::cout << name << " : build " << buildTime << " ms, "
+            << queryNum / seconds.count() * 1e-6 << " M queries/s, "
+            << double(found) / queryNum << " photons/query" << std::endl;
+    };
+
+    std::cout << "Benchmark photon maps, " << photons.size() << " photons, radius " << radius << std::endl;
+    run("KD-tree", tree.m_buildTime, [&](const Float3& center, uint64_t& num) {
+        tree.Query(center, radius, [&](const Photon&) { num++; });
+    });
+    run("Hash grid", grid.m_buildTime, [&](const Float3& center, uint64_t& num) {
+        grid.Query(center, radius, [&](const Photon&) { num++; });
+    });
+}
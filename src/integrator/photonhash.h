@@ -0,0 +1,91 @@
+#pragma once
+
+#include "photon.h"
+
+// Uniform grid for fixed radius queries, cells are hashed into a table and
+// photons are counting sorted by hash so every cell is a contiguous range.
+// With cells 2 * radius wide a query of that radius touches at most 8 cells.
+class PhotonHashGrid {
+public:
+    // Thread safe, photons go to a per-thread buffer until Build()
+    void Add(const Photon& photon) { m_buffers.Add(photon); }
+    void Build(const float& radius);
+    void Clear();
+
+    // Calls _visitor_(photon) for every photon within _radius_ of _center_
+    template<typename Visitor>
+    void Query(const Float3& center, const float& radius, Visitor visitor) const;
+
+    // Sorted by cell hash after Build()
+    std::vector<Photon> m_photons;
+    Bounds m_bounds;
+    // Milliseconds spent in the last Build()
+    float m_buildTime = 0;
+
+private:
+    Int3 Cell(const Float3& p) const {
+        Float3 c = (p - m_bounds.m_pMin) * m_invCellSize;
+        return Int3(int(std::floor(c.x)), int(std::floor(c.y)), int(std::floor(c.z)));
+    }
+    uint32_t Hash(const Int3& cell) const {
+        return ((uint32_t(cell.x) * 73856093u) ^ (uint32_t(cell.y) * 19349663u) ^
+            (uint32_t(cell.z) * 83492791u)) & m_tableMask;
+    }
+    float m_invCellSize = 0;
+    uint32_t m_tableMask = 0;
+    // Photons of hash h are m_photons[m_cellStart[h], m_cellStart[h + 1])
+    std::vector<uint32_t> m_cellStart;
+    std::vector<Photon> m_unsorted;
+    std::vector<uint32_t> m_hashes;
+    PhotonBuffers m_buffers;
+};
+
+template<typename Visitor>
+void PhotonHashGrid::Query(const Float3& center, const float& radius, Visitor visitor) const
+{
+    if (m_photons.empty()) {
+        return;
+    }
+    float sqrRadius = std::sqr(radius);
+    auto visitBucket = [&](const uint32_t& h) {
+        for (uint32_t i = m_cellStart[h]; i < m_cellStart[h + 1]; i++) {
+            if (SqrLength(center - m_photons[i].m_position) <= sqrRadius) {
+                visitor(m_photons[i]);
+            }
+        }
+    };
+
+    Int3 c0 = Cell(center - Float3(radius)), c1 = Cell(center + Float3(radius));
+    uint64_t cellNum = uint64_t(c1.x - c0.x + 1) * (c1.y - c0.y + 1) * (c1.z - c0.z + 1);
+    if (cellNum > m_tableMask) {
+        // Radius far larger than the build radius, every bucket is touched anyway
+        for (uint32_t h = 0; h <= m_tableMask; h++) {
+            visitBucket(h);
+        }
+        return;
+    }
+    // Distinct cells may share a bucket, which must be visited once
+    uint32_t smallHashes[8];
+    std::vector<uint32_t> largeHashes;
+    uint32_t* hashes = smallHashes;
+    if (cellNum > 8) {
+        largeHashes.resize(cellNum);
+        hashes = largeHashes.data();
+    }
+    uint32_t hashNum = 0;
+    for (int z = c0.z; z <= c1.z; z++) {
+        for (int y = c0.y; y <= c1.y; y++) {
+            for (int x = c0.x; x <= c1.x; x++) {
+                hashes[hashNum++] = Hash(Int3(x, y, z));
+            }
+        }
+    }
+    std::sort(hashes, hashes + hashNum);
+    hashNum = std::unique(hashes, hashes + hashNum) - hashes;
+    for (uint32_t i = 0; i < hashNum; i++) {
+        visitBucket(hashes[i]);
+    }
+}
+
+// Times builds and fixed radius queries of both photon maps on _photons_
+void BenchmarkPhotonMaps(const std::vector<Photon>& photons, const float& radius);
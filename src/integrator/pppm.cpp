@@ -1,6 +1,27 @@
 #include "pppm.h"
 
-void PPPMIntegrator::EmitPhoton(Sampler& sampler)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+
+template<typename Visitor>
+float PPPMIntegrator::QueryPhotons(const Float3& center, Visitor visitor) const
+{
+    if (m_photonMapType == PhotonMapType::HashGrid) {
+        m_photonGrid[m_renderMap].Query(center, m_currentRadius, visitor);
+    }
+    else if (m_knn > 0) {
+        // Adaptive radius, clamped by the current one
+        return m_photonTree[m_renderMap].QueryKNN(center, m_knn, m_currentRadius, visitor);
+    }
+    else {
+        m_photonTree[m_renderMap].Query(center, m_currentRadius, visitor);
+    }
+    return std::sqr(m_currentRadius);
+}
+
+void PPPMIntegrator::EmitPhoton(Sampler& sampler, const uint32_t& map)
 {    
     // Randomly pick an emitter
     uint32_t lightNum = m_scene->m_lights.size();
@@ -8,7 +29,7 @@ void PPPMIntegrator::EmitPhoton(Sampler& sampler)
     const auto& light = m_scene->m_lights[lightIdx];
     // Sample photon
     Ray ray;
-    Spectrum flux = light->SamplePhoton(sampler.Next2D(), sampler.Next2D(), ray);
+    Spectrum flux = light->SamplePhoton(sampler.Next2D(), sampler.Next2D(), sampler, ray);
     flux *= lightNum;
     // Trace photon
     for (uint32_t bounce = 0; bounce < m_maxBounce; bounce++) {        
@@ -24,7 +45,7 @@ void PPPMIntegrator::EmitPhoton(Sampler& sampler)
         // Store photon
         Photon photon(hitRec.m_geoRec.m_p, -ray.d, flux);
         if (!isDelta) {
-            m_photonTree.Add(photon);
+            AddPhoton(photon, map);
         }
         // Scatter photon
         MaterialRecord matRec(-ray.d, hitRec.m_geoRec.m_ns, hitRec.m_geoRec.m_st, Importance);
@@ -42,7 +63,7 @@ void PPPMIntegrator::EmitPhoton(Sampler& sampler)
     }
 }
 
-Spectrum PPPMIntegrator::Li(Ray ray, Sampler& sampler)
+Spectrum PPPMIntegrator::Li(Ray ray, IndependentSampler& sampler)
 {
     Spectrum radiance(0.f);
     Spectrum throughput(1.f);
@@ -62,15 +83,13 @@ Spectrum PPPMIntegrator::Li(Ray ray, Sampler& sampler)
 
         // Estimate Li
         if (!isDelta) {
-            std::vector<Photon> gatheredPhotons;
-            m_photonTree.Query(hitRec.m_geoRec.m_p, m_currentRadius, gatheredPhotons);
             Spectrum sum(0.f);
-            for (const auto& photon : gatheredPhotons) {
-                MaterialRecord matRec(-ray.d, photon.m_direction, hitRec.m_geoRec.m_ns, hitRec.m_geoRec.m_st);
+            float sqrRadius = QueryPhotons(hitRec.m_geoRec.m_p, [&](const Photon& photon) {
+                MaterialRecord matRec(-ray.d, photon.Direction(), hitRec.m_geoRec.m_ns, hitRec.m_geoRec.m_st);
                 Spectrum bsdfVal = bsdf->Eval(matRec);
-                sum += bsdfVal / Frame::AbsCosTheta(matRec.m_wo) * photon.m_flux;
-            }
-            float area = M_PI * m_currentRadius * m_currentRadius;
+                sum += bsdfVal / Frame::AbsCosTheta(matRec.m_wo) * photon.Flux();
+            });
+            float area = M_PI * sqrRadius;
             radiance += throughput * sum / (area * m_deltaPhotonNum);
             break;
         }
@@ -118,16 +137,7 @@ void PPPMIntegrator::Start()
     }
     std::reverse(m_tiles.begin(), m_tiles.end());
 
-    m_photons.clear();
-    for (uint32_t i = 0; i < m_deltaPhotonNum; i++) {
-        m_photons.push_back(i);
-    }
-
-    m_renderingNum = 0;
-    m_rendering = true;    
-
-    m_renderThreads.resize(std::thread::hardware_concurrency());
-    //m_renderThreads.resize(1);
+    m_rendering = true;
     m_timer.Start();
     m_controlThread = std::make_unique<std::thread>(&PPPMIntegrator::Render, this);
 }
@@ -142,7 +152,6 @@ void PPPMIntegrator::Wait()
     if (m_controlThread->joinable()) {
         m_controlThread->join();
     }
-    assert(m_renderingNum == 0);
 }
 
 bool PPPMIntegrator::IsRendering()
@@ -152,87 +161,79 @@ bool PPPMIntegrator::IsRendering()
 
 std::string PPPMIntegrator::ToString() const
 {
-    return fmt::format("PPPM\nnmax bounce : {0}\niteration : {1}\n# photon : {2}\nradius : {3}",
-        m_maxBounce, m_currentIteration, m_currentPhotonNum, m_currentRadius);
+    return fmt::format("PPPM\nnmax bounce : {0}\niteration : {1}\n# photon : {2}\nradius : {3}\nbuild : {4:.2f} ms",
+        m_maxBounce, m_currentIteration, m_currentPhotonNum, m_currentRadius,
+        m_photonMapType == PhotonMapType::HashGrid ?
+        m_photonGrid[m_renderMap].m_buildTime : m_photonTree[m_renderMap].m_buildTime);
 }
 
 void PPPMIntegrator::Render()
 {
     m_currentRadius = m_initialRadius;
     m_currentPhotonNum = 0;
-    for (m_currentIteration = 0; m_currentIteration < m_maxIteration && m_rendering; m_currentIteration++) {                
-        m_currentPhotonIndex = 0;
-        m_currentTileIndex = 0;
-        // Photon pass
-        for (std::thread*& thread : m_renderThreads) {
-            thread = new std::thread(&PPPMIntegrator::PhotonIteration, this);
-        }
-        SynchronizeThreads();        
+    tbb::task_arena arena;
+    arena.execute([this] {
+        tbb::task_group photonGroup;
+        PhotonPass(0, m_currentRadius);
+        for (m_currentIteration = 0; m_currentIteration < m_maxIteration && m_rendering; m_currentIteration++) {
+            m_renderMap = m_currentIteration % 2;
+            if (m_benchmark && m_currentIteration == 0) {
+                BenchmarkPhotonMaps(Photons(), m_currentRadius);
+            }
+            float nextRadius = std::sqrt((m_currentIteration + m_alpha) / (m_currentIteration + 1)) * m_currentRadius;
 
-        // Construct photon structure
-        m_photonTree.Build();
+            // Photon pass of the next iteration fills the idle cores of the camera pass
+            if (m_currentIteration + 1 < m_maxIteration) {
+                uint32_t nextIteration = m_currentIteration + 1;
+                photonGroup.run([this, nextIteration, nextRadius] { PhotonPass(nextIteration, nextRadius); });
+            }
+            CameraPass();
+            photonGroup.wait();
 
-        // Camera pass
-        for (std::thread*& thread : m_renderThreads) {
-            thread = new std::thread(&PPPMIntegrator::RenderIteration, this, 1, m_currentIteration);
-        }
-        SynchronizeThreads();
-        
-        // Update settings
-        if (m_currentIteration + 1 != m_maxIteration) {
-            m_photonTree.Clear();
+            // Update settings
+            if (m_currentIteration + 1 != m_maxIteration) {
+                m_photonTree[m_renderMap].Clear();
+                m_photonGrid[m_renderMap].Clear();
+            }
+            m_currentPhotonNum += m_deltaPhotonNum;
+            m_currentRadius = nextRadius;
         }
-        m_currentPhotonNum += m_deltaPhotonNum;
-        m_currentRadius = std::sqrt((m_currentIteration + m_alpha)/(m_currentIteration + 1)) * m_currentRadius;
-    }
+    });
     m_rendering = false;
     m_timer.Stop();
     m_buffer->Save();
 }
 
-void PPPMIntegrator::PhotonIteration()
+void PPPMIntegrator::PhotonPass(const uint32_t& iteration, const float& radius)
 {
-    ++m_renderingNum;
-
-    while (m_rendering) {
-        uint32_t photonIndex;
-        if (m_currentPhotonIndex < m_photons.size()) {
-            photonIndex = m_photons[m_currentPhotonIndex++];
-        }
-        else {
-            break;
-        }
+    uint32_t map = iteration % 2;
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, m_deltaPhotonNum),
+        [&](const tbb::blocked_range<uint32_t>& range) {
+            for (uint32_t i = range.begin(); i < range.end() && m_rendering; i++) {
+                IndependentSampler sampler;
+                uint64_t seed = (uint64_t)iteration * m_deltaPhotonNum + i;
+                sampler.Setup(seed);
+                EmitPhoton(sampler, map);
+            }
+        });
 
-        if (m_rendering) {
-            Sampler sampler;
-            uint64_t seed = (uint64_t)m_currentIteration * m_deltaPhotonNum + photonIndex;
-            sampler.Setup(seed);
-            EmitPhoton(sampler);
-        }
+    // Construct photon structure
+    if (m_photonMapType == PhotonMapType::HashGrid) {
+        m_photonGrid[map].Build(radius);
+    }
+    else {
+        m_photonTree[map].Build();
     }
-
-    m_renderingNum--;
 }
 
-void PPPMIntegrator::RenderIteration(const uint32_t& spp, const uint32_t& iteration)
+void PPPMIntegrator::CameraPass()
 {
-    ++m_renderingNum;
-
-    while (m_rendering) {
-        Framebuffer::Tile tile;
-        if (m_currentTileIndex < m_tiles.size()) {
-            tile = m_tiles[m_currentTileIndex++];
-        }
-        else {
-            break;
-        }
-
-        if (m_rendering) {
-            RenderTile(tile, spp, iteration);
-        }
-    }
-
-    m_renderingNum--;
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, m_tiles.size(), 1),
+        [this](const tbb::blocked_range<uint32_t>& range) {
+            for (uint32_t i = range.begin(); i < range.end() && m_rendering; i++) {
+                RenderTile(m_tiles[i], 1, m_currentIteration);
+            }
+        });
 }
 
 void PPPMIntegrator::RenderTile(
@@ -240,7 +241,7 @@ void PPPMIntegrator::RenderTile(
     const uint32_t& spp,
     const uint32_t& iteration)
 {
-    Sampler sampler;
+    IndependentSampler sampler;
     uint64_t s = (tile.pos[1] * m_buffer->m_width + tile.pos[0]) +
         iteration * (m_buffer->m_width * m_buffer->m_height);
     sampler.Setup(s);
@@ -258,13 +259,20 @@ void PPPMIntegrator::RenderTile(
     }
 }
 
-void PPPMIntegrator::SynchronizeThreads()
+void PPPMIntegrator::AddPhoton(const Photon& photon, const uint32_t& map)
 {
-    for (std::thread*& thread : m_renderThreads) {
-        thread->join();
-        delete thread;
+    if (m_photonMapType == PhotonMapType::HashGrid) {
+        m_photonGrid[map].Add(photon);
+    }
+    else {
+        m_photonTree[map].Add(photon);
     }
-    assert(m_renderingNum == 0);
+}
+
+const std::vector<Photon>& PPPMIntegrator::Photons() const
+{
+    return m_photonMapType == PhotonMapType::HashGrid ?
+        m_photonGrid[m_renderMap].m_photons : m_photonTree[m_renderMap].m_photons;
 }
 
 void PPPMIntegrator::Debug(DebugRecord& debugRec)
@@ -275,7 +283,7 @@ void PPPMIntegrator::Debug(DebugRecord& debugRec)
             pos.y >= 0 && pos.y < m_buffer->m_height)
         {
             int x = pos.x, y = m_buffer->m_height - pos.y;
-            Sampler sampler;
+            IndependentSampler sampler;
             unsigned int s = y * m_buffer->m_width + x;
             sampler.Setup(s);
             Ray ray;
@@ -284,8 +292,8 @@ void PPPMIntegrator::Debug(DebugRecord& debugRec)
         }
     }
     if (debugRec.m_debugKDTree) {        
-        for (const auto& photon : m_photonTree.m_photons) {
-            DrawPoint(photon.m_position, Spectrum(1, 0, 0) * photon.m_flux.y());
+        for (const auto& photon : Photons()) {
+            DrawPoint(photon.m_position, Spectrum(1, 0, 0) * photon.Flux().y());
         }
     }
 }
@@ -311,15 +319,13 @@ void PPPMIntegrator::DebugRay(Ray ray, Sampler& sampler)
 
         // Estimate Li
         if (!isDelta) {
-            std::vector<Photon> gatheredPhotons;
-            m_photonTree.Query(hitRec.m_geoRec.m_p, m_currentRadius, gatheredPhotons);
             Spectrum sum(0.f);
-            for (const auto& photon : gatheredPhotons) {
-                MaterialRecord matRec(-ray.d, photon.m_direction, hitRec.m_geoRec.m_ns, hitRec.m_geoRec.m_st);
+            float sqrRadius = QueryPhotons(hitRec.m_geoRec.m_p, [&](const Photon& photon) {
+                MaterialRecord matRec(-ray.d, photon.Direction(), hitRec.m_geoRec.m_ns, hitRec.m_geoRec.m_st);
                 Spectrum bsdfVal = bsdf->Eval(matRec);
-                sum += bsdfVal / Frame::AbsCosTheta(matRec.m_wo) * photon.m_flux;
-            }
-            float area = M_PI * m_currentRadius * m_currentRadius;
+                sum += bsdfVal / Frame::AbsCosTheta(matRec.m_wo) * photon.Flux();
+            });
+            float area = M_PI * sqrRadius;
             radiance += throughput * sum / (area * m_deltaPhotonNum);
             break;
         }
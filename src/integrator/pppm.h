@@ -2,6 +2,7 @@
 
 #include "core/integrator.h"
 #include "photon.h"
+#include "photonhash.h"
 
 #include <atomic>
 #include <thread>
@@ -17,12 +18,16 @@ public:
         const uint32_t maxIteration,
         const uint32_t deltaPhotonNum,
         const float initialRadius,
-        const float alpha)
+        const float alpha,
+        const PhotonMapType photonMapType = PhotonMapType::KDTree,
+        const bool benchmark = false,
+        const uint32_t knn = 0)
         : Integrator(scene, camera, buffer),
         m_maxBounce(maxBounce), m_maxIteration(maxIteration),
-        m_deltaPhotonNum(deltaPhotonNum), m_initialRadius(initialRadius), m_alpha(alpha) {}
+        m_deltaPhotonNum(deltaPhotonNum), m_initialRadius(initialRadius), m_alpha(alpha),
+        m_photonMapType(photonMapType), m_benchmark(benchmark), m_knn(knn) {}
 
-    Spectrum Li(Ray ray, Sampler& sampler);
+    Spectrum Li(Ray ray, IndependentSampler& sampler);
     void Start();
     void Stop();
     void Wait();
@@ -34,23 +39,24 @@ private:
 
     void Setup();
     void Render();
-    void PhotonIteration();
-    void EmitPhoton(Sampler& sampler);
-    void RenderIteration(const uint32_t& spp, const uint32_t& iteration);
+    // Emits and builds the photons of _iteration_ into photon map iteration % 2
+    void PhotonPass(const uint32_t& iteration, const float& radius);
+    void EmitPhoton(Sampler& sampler, const uint32_t& map);
+    void CameraPass();
     void RenderTile(const Framebuffer::Tile& tile, const uint32_t& spp, const uint32_t& iteration);
-    void SynchronizeThreads();
+    // Photon map dispatch, queries read m_renderMap and return the squared
+    // radius of the gathered neighbourhood
+    void AddPhoton(const Photon& photon, const uint32_t& map);
+    template<typename Visitor>
+    float QueryPhotons(const Float3& center, Visitor visitor) const;
+    const std::vector<Photon>& Photons() const;
     // Debug
     void DebugRay(Ray ray, Sampler& sampler);
 private:
     // Muti-thread setting
-    bool m_rendering;
-    std::atomic<int> m_renderingNum;
-    std::vector<std::thread*> m_renderThreads;
+    std::atomic<bool> m_rendering;
     std::unique_ptr<std::thread> m_controlThread;
     std::vector<Framebuffer::Tile> m_tiles;
-    std::atomic<uint32_t> m_currentTileIndex;
-    std::vector<uint32_t> m_photons;
-    std::atomic<uint32_t> m_currentPhotonIndex;
 
     // Options
     uint32_t m_maxBounce;
@@ -58,12 +64,20 @@ private:
     uint32_t m_deltaPhotonNum;
     float m_initialRadius;
     float m_alpha;
+    PhotonMapType m_photonMapType;
+    bool m_benchmark;
+    // Photons per estimate, 0 gathers within the current radius
+    uint32_t m_knn;
 
     // State
     uint32_t m_currentPhotonNum;
     uint32_t m_currentIteration;
     float m_currentRadius;
+    // Photon map read by the camera pass, the other one is being filled
+    uint32_t m_renderMap = 0;
 
-    // 
-    KDTree m_photonTree;
+    // Double buffered, the photon pass of the next iteration runs
+    // alongside the camera pass of the current one
+    KDTree m_photonTree[2];
+    PhotonHashGrid m_photonGrid[2];
 };
\ No newline at end of file
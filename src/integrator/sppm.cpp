@@ -6,6 +6,8 @@
 #include <tbb/blocked_range.h>
 #include <tbb/concurrent_vector.h>
 
+#include <chrono>
+
 void SPPMIntegrator::Save()
 {
     std::string suffix =
@@ -20,32 +22,187 @@ void SPPMIntegrator::Save()
 
 std::string SPPMIntegrator::ToString() const
 {
-    return fmt::format("SPPM\niteration : {1}\n# photon : {2}",
-        m_currentIteration, m_currentPhotonNum);
+    return fmt::format("SPPM\niteration : {0}\n# photon : {1}\nbuild : {2:.2f} ms",
+        m_currentIteration, m_currentPhotonNum, m_buildTime);
+}
+
+static void AtomicAdd(std::atomic<float>& value, const float& delta)
+{
+    float old = value.load(std::memory_order_relaxed);
+    while (!value.compare_exchange_weak(old, old + delta, std::memory_order_relaxed)) {}
 }
 
 void SPPMIntegrator::InitializeGatherPoints()
 {
+    m_tiles.clear();
     for (int j = 0; j < m_buffer->m_height; j += tile_size) {
         for (int i = 0; i < m_buffer->m_width; i += tile_size) {
-            m_gatherBlocks.push_back(std::vector<GatherPoint>());
-            std::vector<GatherPoint>& points = m_gatherBlocks.back();
-            points.resize(std::min(m_buffer->m_width - i, tile_size) *
-                std::min(m_buffer->m_height - j, tile_size));
-            int index = 0;
-            for (int xoffset = 0; xoffset < tile_size; xoffset++) {
-                if (i + xoffset < m_buffer->m_width) {
+            m_tiles.push_back({
+                {i, j},
+                {std::min(m_buffer->m_width - i, tile_size), std::min(m_buffer->m_height - j, tile_size)}
+                });
+        }
+    }
+
+    m_gatherPoints = std::vector<GatherPoint>(m_buffer->m_width * m_buffer->m_height);
+    for (int y = 0; y < m_buffer->m_height; y++) {
+        for (int x = 0; x < m_buffer->m_width; x++) {
+            GatherPoint& gp = m_gatherPoints[y * m_buffer->m_width + x];
+            gp.m_pos = Int2(x, y);
+            gp.m_radius = m_initialRadius;
+        }
+    }
+}
+
+void SPPMIntegrator::CameraPass(const Framebuffer::Tile& tile)
+{
+    // Initialize sampler
+    IndependentSampler sampler;
+    uint64_t seed = (tile.pos[1] * m_buffer->m_width + tile.pos[0]) +
+        m_currentIteration * (m_buffer->m_width * m_buffer->m_height);
+    sampler.Setup(seed);
+
+    for (int j = 0; j < tile.res[1]; j++) {
+        for (int i = 0; i < tile.res[0]; i++) {
+            int x = i + tile.pos[0], y = j + tile.pos[1];
+            GatherPoint& gp = m_gatherPoints[y * m_buffer->m_width + x];
+            gp.m_throughput = Spectrum(0.f);
+
+            // Generate ray
+            Ray ray;
+            m_camera->GenerateRay(Float2(x, y), sampler, ray);
+
+            // Trace ray to the first diffuse surface
+            Spectrum throughput(1.f);
+            for (int bounce = 0; bounce < m_maxBounce; bounce++) {
+                bool hit = m_scene->Intersect(ray, gp.m_hitRec);
+                gp.m_emission += throughput * m_scene->EvalLight(hit, ray, gp.m_hitRec);
+
+                // No hit
+                if (!hit) {
                     break;
                 }
-                for (int yoffset = 0; yoffset < tile_size; yoffset++) {
-                    if (j + yoffset < m_buffer->m_height) {
-                        break;
-                    }
-                    points[index++].m_pos = Int2(i + xoffset, j + yoffset);
+
+                // Visible point
+                auto& bsdf = gp.m_hitRec.m_primitive->m_bsdf;
+                if (bsdf && !bsdf->IsDelta(gp.m_hitRec.m_geoRec.m_st)) {
+                    gp.m_throughput = throughput;
+                    break;
                 }
+
+                // Hit medium bound
+                if (!bsdf) {
+                    ray = Ray(gp.m_hitRec.m_geoRec.m_p, ray.d);
+                    bounce--;
+                    continue;
+                }
+
+                // Scatter
+                ///Sample BSDF
+                MaterialRecord matRec(-ray.d, gp.m_hitRec.m_geoRec.m_ns, gp.m_hitRec.m_geoRec.m_st);
+                Spectrum bsdfVal = bsdf->Sample(matRec, sampler.Next2D());
+                if (bsdfVal.IsBlack()) {
+                    break;
+                }
+                Float3 dir = matRec.ToWorld(matRec.m_wo);
+                ray = Ray(gp.m_hitRec.m_geoRec.m_p, dir, gp.m_hitRec.GetMedium(dir));
+                throughput *= bsdfVal;
+            }
+        }
+    }
+}
+
+uint32_t SPPMIntegrator::GatherPointHashes(const GatherPoint& gp, uint32_t hashes[8]) const
+{
+    const Float3& p = gp.m_hitRec.m_geoRec.m_p;
+    Int3 c0 = Cell(p - Float3(gp.m_radius)), c1 = Cell(p + Float3(gp.m_radius));
+    uint32_t hashNum = 0;
+    for (int z = c0.z; z <= c1.z; z++) {
+        for (int y = c0.y; y <= c1.y; y++) {
+            for (int x = c0.x; x <= c1.x; x++) {
+                hashes[hashNum++] = Hash(Int3(x, y, z));
             }
         }
     }
+    // Distinct cells may share a bucket, which must hold the point once
+    std::sort(hashes, hashes + hashNum);
+    return std::unique(hashes, hashes + hashNum) - hashes;
+}
+
+void SPPMIntegrator::BuildGatherPointGrid()
+{
+    auto start = std::chrono::steady_clock::now();
+    uint32_t pointNum = m_gatherPoints.size();
+    m_gridBounds = Bounds();
+    float maxRadius = 0;
+    uint32_t validNum = 0;
+    for (const GatherPoint& gp : m_gatherPoints) {
+        if (!gp.m_throughput.IsBlack()) {
+            m_gridBounds = Union(m_gridBounds, Bounds(gp.m_hitRec.m_geoRec.m_p));
+            maxRadius = std::max(maxRadius, gp.m_radius);
+            validNum++;
+        }
+    }
+    m_cellStart.clear();
+    m_gridPoints.clear();
+    if (validNum == 0) {
+        return;
+    }
+    // Slightly wider than the largest gather point, so rounding never lets
+    // one overlap a third cell along an axis
+    m_invCellSize = 1.f / (2.01f * maxRadius);
+    uint32_t tableSize = 1;
+    while (tableSize < 2 * validNum) {
+        tableSize <<= 1;
+    }
+    m_tableMask = tableSize - 1;
+
+    // Count gather points per hash
+    std::vector<std::atomic<uint32_t>> cursors(tableSize);
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, tableSize),
+        [&](const tbb::blocked_range<uint32_t>& range) {
+            for (uint32_t h = range.begin(); h < range.end(); h++) {
+                cursors[h].store(0, std::memory_order_relaxed);
+            }
+        });
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, pointNum),
+        [&](const tbb::blocked_range<uint32_t>& range) {
+            uint32_t hashes[8];
+            for (uint32_t i = range.begin(); i < range.end(); i++) {
+                if (m_gatherPoints[i].m_throughput.IsBlack()) {
+                    continue;
+                }
+                uint32_t hashNum = GatherPointHashes(m_gatherPoints[i], hashes);
+                for (uint32_t k = 0; k < hashNum; k++) {
+                    cursors[hashes[k]].fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+
+    // Exclusive prefix sum, the counters become write cursors
+    m_cellStart.resize(tableSize + 1);
+    m_cellStart[0] = 0;
+    for (uint32_t h = 0; h < tableSize; h++) {
+        uint32_t count = cursors[h].load(std::memory_order_relaxed);
+        cursors[h].store(m_cellStart[h], std::memory_order_relaxed);
+        m_cellStart[h + 1] = m_cellStart[h] + count;
+    }
+
+    m_gridPoints.resize(m_cellStart[tableSize]);
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, pointNum),
+        [&](const tbb::blocked_range<uint32_t>& range) {
+            uint32_t hashes[8];
+            for (uint32_t i = range.begin(); i < range.end(); i++) {
+                if (m_gatherPoints[i].m_throughput.IsBlack()) {
+                    continue;
+                }
+                uint32_t hashNum = GatherPointHashes(m_gatherPoints[i], hashes);
+                for (uint32_t k = 0; k < hashNum; k++) {
+                    m_gridPoints[cursors[hashes[k]].fetch_add(1, std::memory_order_relaxed)] = i;
+                }
+            }
+        });
+    m_buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
 void SPPMIntegrator::PhotonPass(int index)
@@ -62,7 +219,8 @@ void SPPMIntegrator::PhotonPass(int index)
 
     // Sample photon
     Ray ray;
-    Spectrum flux = light->SamplePhoton(sampler.Next2D(), sampler.Next2D(), ray);
+    Spectrum flux = light->SamplePhoton(sampler.Next2D(), sampler.Next2D(), sampler, ray);
+    flux *= lightNum;
 
     // Trace photon
     for (int bounce = 0; bounce < m_maxBounce; bounce++) {
@@ -73,11 +231,10 @@ void SPPMIntegrator::PhotonPass(int index)
             break;
         }
 
-        // Store photon
+        // Splat photon
         auto& bsdf = hitRec.m_primitive->m_bsdf;
         if (bsdf && !bsdf->IsDelta(hitRec.m_geoRec.m_st)) {
-            Photon photon(hitRec.m_geoRec.m_p, -ray.d, flux);
-            m_photonPlane.Add(photon);
+            Splat(hitRec.m_geoRec.m_p, -ray.d, flux);
         }
 
         // Hit medium bound
@@ -105,101 +262,55 @@ void SPPMIntegrator::PhotonPass(int index)
     }
 }
 
-void SPPMIntegrator::BuildPhotonMap()
-{
-    m_photonPlane.Build();
-}
-
-void SPPMIntegrator::CameraPass(int index)
+void SPPMIntegrator::Splat(const Float3& p, const Float3& wo, const Spectrum& flux)
 {
-    std::vector<GatherPoint>& block = m_gatherBlocks[index];
-    // Initialize sampler
-    IndependentSampler sampler;
-    uint64_t seed = (block[0].m_pos.y * m_buffer->m_width + block[0].m_pos.x) +
-        m_currentIteration * (m_buffer->m_width * m_buffer->m_height);
-    sampler.Setup(seed);
-
-    // Trace ray
-    for (GatherPoint& gp : block) {
-        // Generate ray
-        Ray ray;
-        m_camera->GenerateRay(gp.m_pos, sampler, ray);
-
-        // Estimate radiance
-        Spectrum throughput(1.f);
-        float eta = 1.f;
-        for (int bounce = 0;; bounce++) {
-            bool hit = m_scene->Intersect(ray, gp.m_hitRec);
-            gp.m_emission += throughput * m_scene->EvalLight(hit, ray, gp.m_hitRec);
-            
-            // No hit
-            if (!hit) {
-                break;
-            }
-
-            // Estimate radiance
-            auto& bsdf = gp.m_hitRec.m_primitive->m_bsdf;
-            if (bsdf && !bsdf->IsDelta(gp.m_hitRec.m_geoRec.m_st)) {
-                gp.m_throughphut = throughput;
-                break;
-            }
-
-            // Hit medium bound
-            if (!bsdf) {
-                ray = Ray(gp.m_hitRec.m_geoRec.m_p, ray.d);
-                bounce--;
-                continue;
-            }
-
-            // Scatter 
-            ///Sample BSDF
-            MaterialRecord matRec(-ray.d, gp.m_hitRec.m_geoRec.m_ns, gp.m_hitRec.m_geoRec.m_st);
-            Spectrum bsdfVal = bsdf->Sample(matRec, sampler.Next2D());
-            if (bsdfVal.IsBlack()) {
-                break;
-            }
-            Float3 dir = matRec.ToWorld(matRec.m_wo);
-            ray = Ray(gp.m_hitRec.m_geoRec.m_p, dir, gp.m_hitRec.GetMedium(dir));
-            throughput *= bsdfVal;
+    if (m_cellStart.empty()) {
+        return;
+    }
+    uint32_t h = Hash(Cell(p));
+    for (uint32_t i = m_cellStart[h]; i < m_cellStart[h + 1]; i++) {
+        GatherPoint& gp = m_gatherPoints[m_gridPoints[i]];
+        const HitRecord& hitRec = gp.m_hitRec;
+        if (SqrLength(hitRec.m_geoRec.m_p - p) > std::sqr(gp.m_radius)) {
+            continue;
         }
+        auto& bsdf = hitRec.m_primitive->m_bsdf;
+        MaterialRecord matRec(hitRec.m_wi, wo, hitRec.m_geoRec.m_ns, hitRec.m_geoRec.m_st);
+        Spectrum phi = bsdf->Eval(matRec) / Frame::AbsCosTheta(matRec.m_wo) * flux;
+        for (int c = 0; c < 3; c++) {
+            AtomicAdd(gp.m_phi[c], phi[c]);
+        }
+        gp.m_photonNum.fetch_add(1, std::memory_order_relaxed);
     }
 }
 
 void SPPMIntegrator::Update()
 {
-    auto job = [this](const tbb::blocked_range<int>& range) {
-        for (int i = range.begin(); i < range.end(); ++i) {
-            if (!m_rendering) {
-                break;
-            }
-
-            for (GatherPoint& gp : m_gatherBlocks[i]) {
-                Spectrum flux = gp.m_throughphut * EstimatePlane(gp.m_hitRec, gp.m_radius);
+    m_currentPhotonNum += m_deltaPhotonNum;
+    uint32_t iterationNum = m_currentIteration + 1;
+    auto job = [this, iterationNum](const tbb::blocked_range<uint32_t>& range) {
+        for (uint32_t i = range.begin(); i < range.end(); i++) {
+            GatherPoint& gp = m_gatherPoints[i];
+            uint32_t photonNum = gp.m_photonNum.load(std::memory_order_relaxed);
+            if (photonNum > 0) {
+                // Keep a fraction alpha of the new photons and shrink the radius to match
+                float num = gp.m_num + m_alpha * photonNum;
+                float radius = gp.m_radius * std::sqrt(num / (gp.m_num + photonNum));
+                Spectrum phi(gp.m_phi[0].load(), gp.m_phi[1].load(), gp.m_phi[2].load());
+                gp.m_tau = (gp.m_tau + gp.m_throughput * phi) * (std::sqr(radius) / std::sqr(gp.m_radius));
+                gp.m_num = num;
+                gp.m_radius = radius;
+                gp.m_photonNum.store(0, std::memory_order_relaxed);
+                for (std::atomic<float>& value : gp.m_phi) {
+                    value.store(0.f, std::memory_order_relaxed);
+                }
             }
+            float area = M_PI * std::sqr(gp.m_radius);
+            Spectrum radiance = gp.m_emission / float(iterationNum) + gp.m_tau / (area * m_currentPhotonNum);
+            m_buffer->SetSample(gp.m_pos.x, gp.m_pos.y, radiance);
         }
     };
-    tbb::blocked_range<int> tileRange(0, m_gatherBlocks.size());
-    tbb::parallel_for(tileRange, job);
-
-
-    m_photonPlane.Clear();
-    m_currentPhotonNum += m_deltaPhotonNum;
-}
-
-Spectrum SPPMIntegrator::EstimatePlane(const HitRecord& hitRec, float radius)
-{
-    std::shared_ptr<BSDF> bsdf = hitRec.GetBSDF();
-    std::vector<const Photon*> gatheredPhotons;
-    m_photonPlane.Query(hitRec.m_geoRec.m_p, radius, gatheredPhotons);
-    Spectrum sum(0.f);
-    for (const auto& photon : gatheredPhotons) {
-        MaterialRecord matRec(hitRec.m_wi, photon->m_direction, hitRec.m_geoRec.m_ns, hitRec.m_geoRec.m_st);
-        Spectrum bsdfVal = bsdf->Eval(matRec);
-        sum += bsdfVal / Frame::AbsCosTheta(matRec.m_wo) * photon->m_flux;
-    }
-    float area = M_PI * radius * radius;
-    Spectrum radiance = sum / (area * m_deltaPhotonNum);
-    return radiance;
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, m_gatherPoints.size()), job);
 }
 
 void SPPMIntegrator::Start()
@@ -215,48 +326,46 @@ void SPPMIntegrator::Start()
     // Add render thread
     m_renderThread = new std::thread(
         [this] {
-            auto RunPhotonPass = [this]() {
+            auto RunCameraPass = [this]() {
                 auto job = [this](const tbb::blocked_range<int>& range) {
                     for (int i = range.begin(); i < range.end(); ++i) {
                         if (m_rendering) {
-                            PhotonPass(i);
+                            CameraPass(m_tiles[i]);
                         }
                     }
                 };
-                tbb::blocked_range<int> photonRange(0, m_deltaPhotonNum);
-                tbb::parallel_for(photonRange, job);
+                tbb::blocked_range<int> tileRange(0, m_tiles.size());
+                tbb::parallel_for(tileRange, job);
             };
 
-            auto RunCameraPass = [this]() {
+            auto RunPhotonPass = [this]() {
                 auto job = [this](const tbb::blocked_range<int>& range) {
                     for (int i = range.begin(); i < range.end(); ++i) {
                         if (m_rendering) {
-                            CameraPass(i);
+                            PhotonPass(i);
                         }
                     }
                 };
-                tbb::blocked_range<int> tileRange(0, m_gatherBlocks.size());
-                tbb::parallel_for(tileRange, job);
+                tbb::blocked_range<int> photonRange(0, m_deltaPhotonNum);
+                tbb::parallel_for(photonRange, job);
             };
 
-
             // Iteration
             m_currentPhotonNum = 0;
             for (m_currentIteration = 0; m_currentIteration < m_maxIteration && m_rendering; m_currentIteration++) {
-                if (!m_rendering) {
-                    break;
-                }
-                // Photon pass
-                RunPhotonPass();
-
-                // Construct photon structure
-                BuildPhotonMap();
-
                 // Camera pass
                 RunCameraPass();
 
+                // Construct gather point structure
+                BuildGatherPointGrid();
+
+                // Photon pass
+                RunPhotonPass();
+
                 // Update
-                Update();                
+                if (m_rendering) {
+                    Update();
+                }
             }
 
             // Initialize render status (stop)
@@ -275,7 +384,7 @@ void SPPMIntegrator::Debug(DebugRecord& debugRec)
             pos.y >= 0 && pos.y < m_buffer->m_height)
         {
             int x = pos.x, y = m_buffer->m_height - pos.y;
-            Sampler sampler;
+            IndependentSampler sampler;
             unsigned int s = y * m_buffer->m_width + x;
             sampler.Setup(s);
             Ray ray;
@@ -7,16 +7,26 @@
 #include <thread>
 #include <mutex>
 
+// Visible point of a pixel and its progressive statistics (N, tau, r).
+// Photons are splatted into m_phi and m_photonNum during the photon pass.
 class GatherPoint {
 public:
-    GatherPoint() :m_throughphut(0.f), m_sumEmission(0.f), m_emission(0.f), m_radius(0.f), m_num(0.f) {}
+    GatherPoint() :m_throughput(0.f), m_emission(0.f), m_tau(0.f), m_radius(0.f), m_num(0.f), m_photonNum(0) {
+        for (std::atomic<float>& phi : m_phi) {
+            phi.store(0.f, std::memory_order_relaxed);
+        }
+    }
 
     HitRecord m_hitRec;
-    Spectrum m_throughphut;
-    Spectrum m_sumEmission;
+    // Black when the camera path found no diffuse surface
+    Spectrum m_throughput;
+    // Emission seen directly, summed over all iterations
     Spectrum m_emission;
+    Spectrum m_tau;
     float m_radius;
     float m_num;
+    std::atomic<uint32_t> m_photonNum;
+    std::atomic<float> m_phi[3];
     Int2 m_pos;
 };
 
@@ -47,13 +57,24 @@ public:
     std::string ToString() const;
 private:
     void InitializeGatherPoints();
+    void CameraPass(const Framebuffer::Tile& tile);
+    void BuildGatherPointGrid();
     void PhotonPass(int index);
-    void BuildPhotonMap();
-    void CameraPass(int index);
+    void Splat(const Float3& p, const Float3& wo, const Spectrum& flux);
     void Update();
-    Spectrum EstimatePlane(
-        const HitRecord& hitRec,
-        float radius);
+
+    // Gather point grid, cells are 2 * max radius wide so a gather point
+    // overlaps at most 8 of them
+    Int3 Cell(const Float3& p) const {
+        Float3 c = (p - m_gridBounds.m_pMin) * m_invCellSize;
+        return Int3(int(std::floor(c.x)), int(std::floor(c.y)), int(std::floor(c.z)));
+    }
+    uint32_t Hash(const Int3& cell) const {
+        return ((uint32_t(cell.x) * 73856093u) ^ (uint32_t(cell.y) * 19349663u) ^
+            (uint32_t(cell.z) * 83492791u)) & m_tableMask;
+    }
+    // Distinct hashes of the cells overlapped by _gp_, returns their number
+    uint32_t GatherPointHashes(const GatherPoint& gp, uint32_t hashes[8]) const;
 
 private:
     void Debug(DebugRecord& debugRec);
@@ -70,11 +91,20 @@ private:
     uint32_t m_currentPhotonNum;
     uint32_t m_currentIteration;
 
-    // Photons
-    KDTree m_photonPlane;
+    // One gather point per pixel, indexed by y * width + x
+    std::vector<GatherPoint> m_gatherPoints;
+    std::vector<Framebuffer::Tile> m_tiles;
+
+    // Gather points of hash h are m_gridPoints[m_cellStart[h], m_cellStart[h + 1])
+    Bounds m_gridBounds;
+    float m_invCellSize = 0;
+    uint32_t m_tableMask = 0;
+    std::vector<uint32_t> m_cellStart;
+    std::vector<uint32_t> m_gridPoints;
+    // Milliseconds spent in the last BuildGatherPointGrid()
+    float m_buildTime = 0;
 
     // Muti-thread setting
     std::atomic<bool> m_rendering;
-    std::vector<std::vector<GatherPoint>> m_gatherBlocks;
     std::thread* m_renderThread;
-};
\ No newline at end of file
+};
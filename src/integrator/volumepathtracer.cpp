@@ -1,11 +1,14 @@
 #include "volumepathtracer.h"
 #include "light/environment.h"
 
-Spectrum VolumePathIntegrator::Li(Ray ray, Sampler& sampler)
+template<typename SamplerT>
+Spectrum VolumePathIntegrator::Li(Ray ray, SamplerT& sampler)
 {
     Spectrum radiance(0.f);
     Spectrum throughput(1.f);
     float eta = 1.f;
+    // The previous vertex took a light sample, volume emission is covered there
+    bool lightSampled = false;
     HitRecord hitRec;
     bool hit = m_scene->Intersect(ray, hitRec);
     for (int bounce = 0; bounce < m_maxBounce; bounce++) {
@@ -15,10 +18,17 @@ Spectrum VolumePathIntegrator::Li(Ray ray, Sampler& sampler)
         else {
             //return Spectrum(0.f);
         }
+        // Coarser medium once the path carries little detail, equiangular
+        // sampling only competes with exact distance sampling
+        uint32_t level = hit && ray.m_medium ? ray.m_medium->SelectLevel(bounce, throughput) : 0;
+        // Equiangular sampling toward delta lights, MIS with distance sampling
+        if (m_equiangular && level == 0 && hit && ray.m_medium) {
+            radiance += throughput * SampleEquiangularLight(ray, sampler);
+        }
         // Sample medium
         MediumRecord mediumRec;
         if (hit && ray.m_medium) {
-            throughput *= ray.m_medium->Sample(ray, mediumRec, sampler);
+            throughput *= ray.m_medium->Sample(ray, mediumRec, sampler, level);
         }
         if (throughput.IsBlack()) {
             break;
@@ -30,7 +40,9 @@ Spectrum VolumePathIntegrator::Li(Ray ray, Sampler& sampler)
             }
 
             if (!mediumRec.m_Le.IsBlack()) {
-                radiance += throughput * mediumRec.m_Le;
+                if (!ray.m_medium->m_hasVolumeLight || !lightSampled) {
+                    radiance += throughput * mediumRec.m_Le;
+                }
                 break;
             }
 
@@ -39,7 +51,8 @@ Spectrum VolumePathIntegrator::Li(Ray ray, Sampler& sampler)
             // Sample light
             {
                 LightRecord lightRec(mediumRec.m_p);
-                Spectrum emission = SampleLight(lightRec, sampler, medium);
+                uint32_t lightIdx;
+                Spectrum emission = SampleLight(lightRec, sampler, medium, lightIdx, level);
                 if (!emission.IsBlack()) {
                     // Allocate a record for querying the phase function
                     PhaseFunctionRecord phaseRec(-ray.d, lightRec.m_wi);
@@ -47,10 +60,24 @@ Spectrum VolumePathIntegrator::Li(Ray ray, Sampler& sampler)
                     Spectrum phaseVal = phase->EvalPdf(phaseRec);
                     if (!phaseVal.IsBlack()) {
                         // Weight using the power heuristic
-                        float weight = PowerHeuristic(lightRec.m_pdf, phaseRec.m_pdf);
+                        float weight;
+                        const auto& light = m_scene->m_lights[lightIdx];
+                        if (lightRec.m_volume) {
+                            weight = 1.f;
+                        }
+                        else if (light->IsDelta()) {
+                            // Phase sampling can't hit a delta light, compete with equiangular sampling only
+                            weight = m_equiangular && level == 0 && !light->IsInfinite() ? PowerHeuristic(
+                                medium->PdfDistance(ray, mediumRec.m_t, sampler),
+                                PdfEquiangular(ray, lightRec.m_geoRec.m_p, mediumRec.m_t)) : 1.f;
+                        }
+                        else {
+                            weight = PowerHeuristic(lightRec.m_pdf, phaseRec.m_pdf);
+                        }
                         radiance += throughput * phaseVal * emission * weight;
                     }
                 }
+                lightSampled = true;
             }
 
             // Sample phase function
@@ -63,7 +90,7 @@ Spectrum VolumePathIntegrator::Li(Ray ray, Sampler& sampler)
                 throughput *= phaseVal;
                 // Eval light                
                 Spectrum transmittance;
-                hit = m_scene->IntersectTr(ray, hitRec, transmittance, sampler);
+                hit = m_scene->IntersectTr(ray, hitRec, transmittance, sampler, level);
                 ray = Ray(mediumRec.m_p, phaseRec.m_wo, medium);
                 LightRecord lightRec;
                 Spectrum emission = EvalPdfLight(hit, ray, hitRec, lightRec);
@@ -111,11 +138,12 @@ Spectrum VolumePathIntegrator::Li(Ray ray, Sampler& sampler)
                     Spectrum bsdfVal = bsdf->EvalPdf(matRec);
                     if (!bsdfVal.IsBlack()) {
                         // Weight using the power heuristic
-                        float weight = PowerHeuristic(lightRec.m_pdf, matRec.m_pdf);
+                        float weight = lightRec.m_volume ? 1.f : PowerHeuristic(lightRec.m_pdf, matRec.m_pdf);
                         radiance += throughput * bsdfVal * emission * weight;
                     }
                 }
             }
+            lightSampled = !bsdf->IsDelta(hitRec.m_geoRec.m_st);
 
             // Sample BSDF
             {
@@ -162,9 +190,15 @@ Spectrum VolumePathIntegrator::Li(Ray ray, Sampler& sampler)
     return radiance;
 }
 
+void VolumePathIntegrator::RenderTile(const Framebuffer::Tile& tile)
+{
+    SampleIntegrator::RenderTile(tile, this);
+}
+
 std::string VolumePathIntegrator::ToString() const
 {
-    return fmt::format("Volume Path Tracer\nspp : {0}\nmax bounce : {1}", m_spp, m_maxBounce);
+    return fmt::format("Volume Path Tracer\nspp : {0}\nmax bounce : {1}\nequiangular : {2}",
+        m_spp, m_maxBounce, m_equiangular);
 }
 
 Spectrum VolumePathIntegrator::EvalLight(bool hit, const Ray& ray, const HitRecord& hitRec) const
@@ -212,18 +246,35 @@ Spectrum VolumePathIntegrator::EvalPdfLight(bool hit, const Ray& ray, const HitR
 Spectrum VolumePathIntegrator::SampleLight(
     LightRecord& lightRec, 
     Sampler& sampler,
-    const std::shared_ptr<Medium>& medium) const
+    const std::shared_ptr<Medium>& medium,
+    uint32_t& lightIdx,
+    const uint32_t& level) const
 {
     uint32_t lightNum = m_scene->m_lights.size();
     if (lightNum == 0) {
         return Spectrum(0.f);
     }
     // Randomly pick an emitter
-    uint32_t lightIdx = std::min(uint32_t(lightNum * sampler.Next1D()), lightNum - 1);
+    lightIdx = std::min(uint32_t(lightNum * sampler.Next1D()), lightNum - 1);
     float lightChoosePdf = 1.f / lightNum;
     const auto& light = m_scene->m_lights[lightIdx];
+    Spectrum emission = SampleLight(light, lightRec, sampler, medium, level);
+    if (emission.IsBlack()) {
+        return Spectrum(0.f);
+    }
+    lightRec.m_pdf *= lightChoosePdf;
+    return emission / lightChoosePdf;
+}
+
+Spectrum VolumePathIntegrator::SampleLight(
+    const std::shared_ptr<Light>& light,
+    LightRecord& lightRec,
+    Sampler& sampler,
+    const std::shared_ptr<Medium>& medium,
+    const uint32_t& level) const
+{
     // Sample on light
-    Spectrum emission = light->Sample(lightRec, sampler.Next2D());
+    Spectrum emission = light->Sample(lightRec, sampler.Next2D(), sampler);
     // Occlude test
     if (lightRec.m_pdf != 0) {
         // Handle medium
@@ -236,22 +287,21 @@ Spectrum VolumePathIntegrator::SampleLight(
             bool hit = m_scene->Intersect(ray, hitRec);
             if (!hit) {
                 // Light inside the medium
-                throughput *= medium->Transmittance(ray, sampler);
+                throughput *= medium->Transmittance(ray, sampler, level);
                 occlude = false;
             }
             else {
                 // Light outside the medium
-                throughput *= medium->Transmittance(ray, sampler);
+                throughput *= medium->Transmittance(ray, sampler, level);
                 ray = Ray(ray(ray.tMax), ray.d, Ray::epsilon, tMax - ray.tMax);
                 occlude = m_scene->Occlude(ray);
             }
         }
-        // Update pdf and Le
+        // Update Le
         if (occlude) {
             return Spectrum(0.0f);
-        }        
-        lightRec.m_pdf *= lightChoosePdf;
-        emission *= throughput / lightChoosePdf;
+        }
+        emission *= throughput;
         return emission;
     }
     else {
@@ -259,6 +309,49 @@ Spectrum VolumePathIntegrator::SampleLight(
     }
 }
 
+Spectrum VolumePathIntegrator::SampleEquiangularLight(const Ray& ray, Sampler& sampler) const
+{
+    uint32_t lightNum = m_scene->m_lights.size();
+    if (lightNum == 0) {
+        return Spectrum(0.f);
+    }
+    // Randomly pick an emitter
+    uint32_t lightIdx = std::min(uint32_t(lightNum * sampler.Next1D()), lightNum - 1);
+    float lightChoosePdf = 1.f / lightNum;
+    const auto& light = m_scene->m_lights[lightIdx];
+    // Area and infinite lights are handled by light / phase sampling
+    if (!light->IsDelta() || light->IsInfinite()) {
+        return Spectrum(0.f);
+    }
+    const auto& medium = ray.m_medium;
+    // Get light position
+    LightRecord posRec(ray.o);
+    Float2 s(0.f);
+    light->Sample(posRec, s);
+    Float3 pLight = posRec.m_geoRec.m_p;
+    // Sample distance
+    float pdf;
+    float t = SampleEquiangular(ray, pLight, sampler.Next1D(), pdf);
+    if (pdf == 0) {
+        return Spectrum(0.f);
+    }
+    Float3 p = ray(t);
+    LightRecord lightRec(p);
+    Spectrum emission = SampleLight(light, lightRec, sampler, medium);
+    if (emission.IsBlack()) {
+        return Spectrum(0.f);
+    }
+    PhaseFunctionRecord phaseRec(-ray.d, lightRec.m_wi);
+    Spectrum phaseVal = medium->m_phaseFunction->EvalPdf(phaseRec);
+    if (phaseVal.IsBlack()) {
+        return Spectrum(0.f);
+    }
+    Spectrum transmittance = medium->Transmittance(Ray(ray.o, ray.d, 0, t), sampler);
+    // Weight using the power heuristic
+    float weight = PowerHeuristic(pdf, medium->PdfDistance(ray, t, sampler));
+    return transmittance * medium->SigmaS(p) * phaseVal * emission * weight / (pdf * lightChoosePdf);
+}
+
 void VolumePathIntegrator::Debug(DebugRecord& debugRec)
 {
     if (debugRec.m_debugRay) {
@@ -267,7 +360,7 @@ void VolumePathIntegrator::Debug(DebugRecord& debugRec)
             pos.y >= 0 && pos.y < m_buffer->m_height)
         {
             int x = pos.x, y = m_buffer->m_height - pos.y;
-            Sampler sampler;
+            IndependentSampler sampler;
             unsigned int s = y * m_buffer->m_width + x;
             sampler.Setup(s);
             Ray ray;
@@ -9,10 +9,19 @@ public:
         const std::shared_ptr<Camera>& camera,
         const std::shared_ptr<Framebuffer>& buffer,
         const uint32_t maxBounce,
-        const uint32_t spp)
-        : SampleIntegrator(scene, camera, buffer, spp), m_maxBounce(maxBounce) {}
+        const uint32_t spp,
+        const SamplerType samplerType = SamplerType::Independent,
+        const bool equiangular = false)
+        : SampleIntegrator(scene, camera, buffer, spp, samplerType), m_maxBounce(maxBounce),
+        m_equiangular(equiangular)
+    {
+        // Pixel jitter, then light, bsdf/phase and roulette samples per bounce
+        m_sampleDimension = 2 + 5 * maxBounce;
+    }
 
-    Spectrum Li(Ray ray, Sampler& sampler);
+    template<typename SamplerT>
+    Spectrum Li(Ray ray, SamplerT& sampler);
+    void RenderTile(const Framebuffer::Tile& tile);
     std::string ToString() const;    
 private:
     void Setup() { Integrator::Setup(); }
@@ -28,11 +37,23 @@ private:
     Spectrum SampleLight(
         LightRecord& lightRec,
         Sampler& sampler,
-        const std::shared_ptr<Medium>& medium) const;
+        const std::shared_ptr<Medium>& medium,
+        uint32_t& lightIdx,
+        const uint32_t& level = 0) const;
+    Spectrum SampleLight(
+        const std::shared_ptr<Light>& light,
+        LightRecord& lightRec,
+        Sampler& sampler,
+        const std::shared_ptr<Medium>& medium,
+        const uint32_t& level = 0) const;
+    Spectrum SampleEquiangularLight(
+        const Ray& ray,
+        Sampler& sampler) const;
     // Debug
     void Debug(DebugRecord& debugRec);
     void DebugRay(Ray ray, Sampler& sampler);
 private:
     // Options
-    uint32_t m_maxBounce;    
+    uint32_t m_maxBounce;
+    bool m_equiangular;
 };
\ No newline at end of file
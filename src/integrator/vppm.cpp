@@ -5,6 +5,19 @@
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
 #include <tbb/concurrent_vector.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+
+template<typename Visitor>
+float VPPMIntegrator::QueryPhotons(const KDTree& tree, const Float3& center, Visitor visitor) const
+{
+    if (m_knn > 0) {
+        // Adaptive radius, clamped by the current one
+        return tree.QueryKNN(center, m_knn, m_currentRadius, visitor);
+    }
+    tree.Query(center, m_currentRadius, visitor);
+    return std::sqr(m_currentRadius);
+}
 
 void VPPMIntegrator::Save()
 {
@@ -20,8 +33,11 @@ void VPPMIntegrator::Save()
 
 std::string VPPMIntegrator::ToString() const
 {
-    return fmt::format("VPPM\nnmax bounce : {0}\niteration : {1}\n# photon : {2}\nradius : {3}",
-        m_maxBounce, m_currentIteration, m_currentPhotonNum, m_currentRadius);
+    return fmt::format("VPPM\nnmax bounce : {0}\niteration : {1}\n# photon : {2}\nradius : {3}\n"
+        "build : {4:.2f} ms (medium) {5:.2f} ms (surface) {6:.2f} ms (medium bvh) {7:.2f} ms (beams)",
+        m_maxBounce, m_currentIteration, m_currentPhotonNum, m_currentRadius,
+        m_photonMedium[m_renderMap].m_buildTime, m_photonPlane[m_renderMap].m_buildTime,
+        m_photonMediumBVH[m_renderMap].m_buildTime, m_photonBeams[m_renderMap].m_buildTime);
 }
 
 void VPPMIntegrator::Start()
@@ -45,16 +61,7 @@ void VPPMIntegrator::Start()
     // Add render thread
     m_renderThread = new std::thread(
         [this] {
-            // Photon pass
-            auto photonPass = [this](const tbb::blocked_range<int>& range) {
-                for (int i = range.begin(); i < range.end(); ++i) {
-                    if (m_rendering) {
-                        EmitPhoton(i);
-                    }
-                }
-            };
-
-            // Camera pass            
+            // Camera pass
             auto cameraPass = [this](const tbb::blocked_range<int>& range) {
                 for (int i = range.begin(); i < range.end(); ++i) {
                     Framebuffer::Tile& tile = m_tiles[i];
@@ -63,48 +70,37 @@ void VPPMIntegrator::Start()
                     }
                 }
             };
-            
+
             // Iteration
             m_currentRadius = m_initialRadius;
             m_currentPhotonNum = 0;
-            for (m_currentIteration = 0; m_currentIteration < m_maxIteration && m_rendering; m_currentIteration++) {
-                if (!m_rendering) {
-                    break;
-                }
-                // Photon pass
-                tbb::blocked_range<int> photonRange(0, m_deltaPhotonNum);
-#ifdef _DEBUG
-                //photonPass(photonRange);
-                tbb::parallel_for(photonRange, photonPass);
-#else
-                //photonPass(photonRange);
-                tbb::parallel_for(photonRange, photonPass);
-#endif // _DEBUG
-
-
-                // Construct photon structure
-                m_photonMedium.Build(m_currentRadius);
-                m_photonPlane.Build();
-
-                // Camera pass
-                tbb::blocked_range<int> tileRange(0, m_tiles.size());
-#ifdef _DEBUG
-                //cameraPass(tileRange);
-                tbb::parallel_for(tileRange, cameraPass);
-#else
-                tbb::parallel_for(tileRange, cameraPass);
-#endif // _DEBUG
-
-
-                // Update settings
-                if (m_currentIteration + 1 != m_maxIteration) {
-                    m_photonMedium.Clear();
-                    m_photonPlane.Clear();
+            tbb::task_arena arena;
+            arena.execute([&] {
+                tbb::task_group photonGroup;
+                PhotonPass(0, m_currentRadius);
+                for (m_currentIteration = 0; m_currentIteration < m_maxIteration && m_rendering; m_currentIteration++) {
+                    m_renderMap = m_currentIteration % 2;
+                    float nextRadius = std::sqrt((m_currentIteration + m_alpha) / (m_currentIteration + 1)) *
+                        m_currentRadius;
+
+                    // Photon pass of the next iteration fills the idle cores of the camera pass
+                    if (m_currentIteration + 1 < m_maxIteration) {
+                        uint32_t nextIteration = m_currentIteration + 1;
+                        photonGroup.run([this, nextIteration, nextRadius] { PhotonPass(nextIteration, nextRadius); });
+                    }
+                    tbb::parallel_for(tbb::blocked_range<int>(0, m_tiles.size()), cameraPass);
+                    photonGroup.wait();
+
+                    // Update settings
+                    if (m_currentIteration + 1 != m_maxIteration) {
+                        m_photonMedium[m_renderMap].Clear();
+                        m_photonPlane[m_renderMap].Clear();
+                        m_photonBeams[m_renderMap].Clear();
+                    }
+                    m_currentPhotonNum += m_deltaPhotonNum;
+                    m_currentRadius = nextRadius;
                 }
-                m_currentPhotonNum += m_deltaPhotonNum;
-                m_currentRadius = std::sqrt((m_currentIteration + m_alpha) / (m_currentIteration + 1)) *
-                    m_currentRadius;
-            }
+            });
 
             // Initialize render status (stop)
             m_rendering = false;
@@ -114,6 +110,29 @@ void VPPMIntegrator::Start()
     );
 }
 
+void VPPMIntegrator::PhotonPass(const uint32_t& iteration, const float& radius)
+{
+    uint32_t map = iteration % 2;
+    tbb::parallel_for(tbb::blocked_range<int>(0, m_deltaPhotonNum),
+        [&](const tbb::blocked_range<int>& range) {
+            for (int i = range.begin(); i < range.end(); ++i) {
+                if (m_rendering) {
+                    EmitPhoton(i, iteration);
+                }
+            }
+        });
+
+    // Construct photon structure
+    m_photonMedium[map].Build();
+    m_photonPlane[map].Build();
+    if (m_mediumEstimator == MediumEstimator::Beam) {
+        m_photonMediumBVH[map].Build(m_photonMedium[map].m_photons, radius);
+    }
+    if (UsePhotonBeams()) {
+        m_photonBeams[map].Build(radius);
+    }
+}
+
 void VPPMIntegrator::RenderTile(const Framebuffer::Tile& tile)
 {
     IndependentSampler sampler;
@@ -142,14 +161,15 @@ void VPPMIntegrator::RenderTile(const Framebuffer::Tile& tile)
     }
 }
 
-void VPPMIntegrator::EmitPhoton(const uint32_t& photonIndex)
+void VPPMIntegrator::EmitPhoton(const uint32_t& photonIndex, const uint32_t& iteration)
 {
     if (!m_rendering) {
         return;
     }
     // Initialize sampler
     IndependentSampler sampler;
-    uint64_t seed = (uint64_t)m_currentIteration * m_deltaPhotonNum + photonIndex;
+    uint64_t seed = (uint64_t)iteration * m_deltaPhotonNum + photonIndex;
+    uint32_t map = iteration % 2;
     sampler.Setup(seed);
     // Randomly pick an emitter
     uint32_t lightNum = m_scene->m_lights.size();
@@ -157,7 +177,7 @@ void VPPMIntegrator::EmitPhoton(const uint32_t& photonIndex)
     const auto& light = m_scene->m_lights[lightIdx];
     // Sample photon
     Ray ray;
-    Spectrum flux = light->SamplePhoton(sampler.Next2D(), sampler.Next2D(), ray);
+    Spectrum flux = light->SamplePhoton(sampler.Next2D(), sampler.Next2D(), sampler, ray);
     flux *= lightNum;
     // Trace photon
     for (int bounce = 0; bounce < m_maxBounce; bounce++) {
@@ -170,17 +190,25 @@ void VPPMIntegrator::EmitPhoton(const uint32_t& photonIndex)
         // Sample medium
         MediumRecord mediumRec;
         if (ray.m_medium) {
+            Spectrum beamFlux = flux;
             flux *= ray.m_medium->Sample(ray, mediumRec, sampler);
+            if (UsePhotonBeams()) {
+                float length = mediumRec.m_internal ? mediumRec.m_t : hitRec.m_t;
+                m_photonBeams[map].Add(PhotonBeam(ray.o, ray.d, length, beamFlux, ray.m_medium->SigmaT(ray.o)));
+            }
         }
         // Store photon
         auto& bsdf = hitRec.m_primitive->m_bsdf;
         if (mediumRec.m_internal) {
-            Photon photon(mediumRec.m_p, -ray.d, flux);
-            m_photonMedium.Add(photon);
+            // Beams already cover the collision
+            if (!UsePhotonBeams()) {
+                Photon photon(mediumRec.m_p, -ray.d, flux);
+                m_photonMedium[map].Add(photon);
+            }
         }
         else if (bsdf && !bsdf->IsDelta(hitRec.m_geoRec.m_st)) {
             Photon photon(hitRec.m_geoRec.m_p, -ray.d, flux);
-            m_photonPlane.Add(photon);
+            m_photonPlane[map].Add(photon);
         }
         // Hit medium bound
         if (!mediumRec.m_internal && !bsdf) {
@@ -218,7 +246,7 @@ void VPPMIntegrator::EmitPhoton(const uint32_t& photonIndex)
     }
 }
 
-Spectrum VPPMIntegrator::Li(Ray ray, Sampler& sampler)
+Spectrum VPPMIntegrator::Li(Ray ray, IndependentSampler& sampler)
 {
     Spectrum radiance(0.f);
     Spectrum throughput(1.f);
@@ -235,14 +263,23 @@ Spectrum VPPMIntegrator::Li(Ray ray, Sampler& sampler)
         MediumRecord mediumRec;
         Spectrum mediumTr(1.f);
         if (ray.m_medium) {
-            mediumTr = ray.m_medium->Sample(ray, mediumRec, sampler);
+            if (m_mediumEstimator == MediumEstimator::Beam || m_mediumEstimator == MediumEstimator::BeamBeam) {
+                // In-scattering of the whole segment, then on to the surface
+                auto& phase = ray.m_medium->m_phaseFunction;
+                radiance += throughput * (m_mediumEstimator == MediumEstimator::Beam ?
+                    EstimateMediumBeam3D(ray, phase, sampler) : EstimateMediumBeam1D(ray, phase, sampler));
+                mediumTr = ray.m_medium->Transmittance(ray, sampler);
+            }
+            else {
+                mediumTr = ray.m_medium->Sample(ray, mediumRec, sampler);
+            }
         }
         // Estimate radiance
         auto& bsdf = hitRec.m_primitive->m_bsdf;
         auto& phase = ray.m_medium->m_phaseFunction;
         if (mediumRec.m_internal) {
-            //radiance += throughput * EstimateMediumBeam3D(ray, mediumRec, phase, sampler);
-            radiance += mediumTr * throughput * EstimateMediumPoint3D(ray, mediumRec, phase);            
+            radiance += mediumTr * throughput * (m_mediumEstimator == MediumEstimator::PointBeam ?
+                EstimateMediumPoint2D(ray, mediumRec, phase) : EstimateMediumPoint3D(ray, mediumRec, phase));            
             break;
         }
         else if (bsdf && !bsdf->IsDelta(hitRec.m_geoRec.m_st)) {
@@ -292,29 +329,24 @@ Spectrum VPPMIntegrator::Li(Ray ray, Sampler& sampler)
 }
 
 Spectrum VPPMIntegrator::EstimateMediumBeam3D(
-    const Ray& ray, 
-    const MediumRecord& mediumRec, 
+    const Ray& ray,
     const std::shared_ptr<PhaseFunction>& phase,
     Sampler& sampler)
 {
-    Ray beam(ray.o, ray.d, 0, mediumRec.m_t);
-    std::vector<std::pair<const Photon*, float>> gatheredPhotons;
-    m_photonMedium.QueryBeam(beam, m_currentRadius, gatheredPhotons);
     Spectrum sum(0.f);
-    for (const auto& p : gatheredPhotons) {
-        const auto& photon = p.first;
-        const auto& t = p.second;
+    m_photonMediumBVH[m_renderMap].QueryBeam(ray, [&](const Photon& photon, const float& t) {
         // Estimate Tr
         Spectrum Tr = ray.m_medium->Transmittance(Ray(ray.o, ray.d, 0, t), sampler);
         // Evaluate phase function
-        PhaseFunctionRecord phaseRec(-ray.d, photon->m_direction);
+        PhaseFunctionRecord phaseRec(-ray.d, photon.Direction());
         Spectrum phaseVal = phase->EvalPdf(phaseRec);
-        // Add contribution
-        sum += Tr * phaseVal * photon->m_flux;
-    }
-    float num = gatheredPhotons.empty() ? 1 : gatheredPhotons.size();
-    float vol = 4.f / 3.f * M_PI * m_currentRadius * m_currentRadius * m_currentRadius;
-    Spectrum radiance = sum / (vol * m_deltaPhotonNum * 25);
+        // Add contribution, sigma_s of the integrand cancels the 1 / sigma_s
+        // of the point photon density
+        sum += Tr * phaseVal * photon.Flux();
+    });
+    // Photon spheres blurred onto the beam give a 2D kernel
+    float area = M_PI * m_currentRadius * m_currentRadius;
+    Spectrum radiance = sum / (area * m_deltaPhotonNum);
     return radiance;
 }
 
@@ -323,33 +355,73 @@ Spectrum VPPMIntegrator::EstimateMediumPoint3D(
     const MediumRecord& mediumRec,
     const std::shared_ptr<PhaseFunction>& phase)
 {
-    std::vector<const Photon*> gatheredPhotons;
-    m_photonMedium.Query(mediumRec.m_p, m_currentRadius, gatheredPhotons);
     Spectrum sum(0.f);
-    for (const auto& photon : gatheredPhotons) {
-        PhaseFunctionRecord phaseRec(-ray.d, photon->m_direction);
+    float sqrRadius = QueryPhotons(m_photonMedium[m_renderMap], mediumRec.m_p, [&](const Photon& photon) {
+        PhaseFunctionRecord phaseRec(-ray.d, photon.Direction());
         Spectrum phaseVal = phase->EvalPdf(phaseRec);
-        sum += phaseVal * photon->m_flux;
+        sum += phaseVal * photon.Flux();
+    });
+    // Photons are stored at scattering collisions, so their density carries
+    // a factor sigma_s (Jensen and Christensen 1998)
+    Spectrum sigmaS = ray.m_medium->SigmaS(mediumRec.m_p);
+    for (uint32_t c = 0; c < 3; c++) {
+        sum[c] = sigmaS[c] > 0 ? sum[c] / sigmaS[c] : 0.f;
     }
-    float vol = 4.f / 3.f * M_PI * m_currentRadius * m_currentRadius * m_currentRadius;
+    float vol = 4.f / 3.f * M_PI * sqrRadius * std::sqrt(sqrRadius);
     Spectrum radiance = sum / (vol * m_deltaPhotonNum);
     return radiance;
 }
 
+Spectrum VPPMIntegrator::EstimateMediumBeam1D(
+    const Ray& ray,
+    const std::shared_ptr<PhaseFunction>& phase,
+    Sampler& sampler)
+{
+    Spectrum sum(0.f);
+    m_photonBeams[m_renderMap].QueryBeam(ray, [&](const PhotonBeam& beam, const float& t, const float& tBeam, const float& sinTheta) {
+        // Estimate Tr
+        Spectrum Tr = ray.m_medium->Transmittance(Ray(ray.o, ray.d, 0, t), sampler);
+        // Evaluate phase function
+        PhaseFunctionRecord phaseRec(-ray.d, -beam.m_direction);
+        Spectrum phaseVal = phase->EvalPdf(phaseRec);
+        // Add contribution
+        sum += Tr * ray.m_medium->SigmaS(ray(t)) * phaseVal * beam.Flux(tBeam) / sinTheta;
+    });
+    // Beams blurred perpendicular to both lines give a 1D kernel
+    float width = 2 * m_currentRadius;
+    Spectrum radiance = sum / (width * m_deltaPhotonNum);
+    return radiance;
+}
+
+Spectrum VPPMIntegrator::EstimateMediumPoint2D(
+    const Ray& ray,
+    const MediumRecord& mediumRec,
+    const std::shared_ptr<PhaseFunction>& phase)
+{
+    Spectrum sum(0.f);
+    m_photonBeams[m_renderMap].Query(mediumRec.m_p, [&](const PhotonBeam& beam, const float& tBeam) {
+        PhaseFunctionRecord phaseRec(-ray.d, -beam.m_direction);
+        Spectrum phaseVal = phase->EvalPdf(phaseRec);
+        sum += phaseVal * beam.Flux(tBeam);
+    });
+    // Beams blurred perpendicular to themselves give a 2D kernel
+    float area = M_PI * m_currentRadius * m_currentRadius;
+    Spectrum radiance = sum / (area * m_deltaPhotonNum);
+    return radiance;
+}
+
 Spectrum VPPMIntegrator::EstimatePlane(
     const Ray& ray,
     const HitRecord& hitRec,
     const std::shared_ptr<BSDF>& bsdf)
 {
-    std::vector<const Photon*> gatheredPhotons;
-    m_photonPlane.Query(hitRec.m_geoRec.m_p, m_currentRadius, gatheredPhotons);
     Spectrum sum(0.f);
-    for (const auto& photon : gatheredPhotons) {
-        MaterialRecord matRec(-ray.d, photon->m_direction, hitRec.m_geoRec.m_ns, hitRec.m_geoRec.m_st);
+    float sqrRadius = QueryPhotons(m_photonPlane[m_renderMap], hitRec.m_geoRec.m_p, [&](const Photon& photon) {
+        MaterialRecord matRec(-ray.d, photon.Direction(), hitRec.m_geoRec.m_ns, hitRec.m_geoRec.m_st);
         Spectrum bsdfVal = bsdf->Eval(matRec);
-        sum += bsdfVal / Frame::AbsCosTheta(matRec.m_wo) * photon->m_flux;
-    }
-    float area = M_PI * m_currentRadius * m_currentRadius;
+        sum += bsdfVal / Frame::AbsCosTheta(matRec.m_wo) * photon.Flux();
+    });
+    float area = M_PI * sqrRadius;
     Spectrum radiance = sum / (area * m_deltaPhotonNum);
     return radiance;
 }
@@ -362,7 +434,7 @@ void VPPMIntegrator::Debug(DebugRecord& debugRec)
             pos.y >= 0 && pos.y < m_buffer->m_height)
         {
             int x = pos.x, y = m_buffer->m_height - pos.y;
-            Sampler sampler;
+            IndependentSampler sampler;
             unsigned int s = y * m_buffer->m_width + x;
             sampler.Setup(s);
             Ray ray;
@@ -392,12 +464,10 @@ Spectrum VPPMIntegrator::LiDebug(Ray ray, Sampler& sampler)
         }
         if (!mediumRec.m_internal) {
             // Estimate radiance
-            std::vector<Photon> gatheredPhotons;
-            m_photonMedium.Query(mediumRec.m_p, m_currentRadius, gatheredPhotons);
             Spectrum sum(0.f);
-            for (const auto& photon : gatheredPhotons) {
-                sum += photon.m_flux;
-            }
+            m_photonMedium[m_renderMap].Query(mediumRec.m_p, m_currentRadius, [&](const Photon& photon) {
+                sum += photon.Flux();
+            });
             float vol = 4.f / 3.f * M_PI * m_currentRadius * m_currentRadius * m_currentRadius;
             radiance += sum / (vol * m_deltaPhotonNum);
         }
@@ -411,12 +481,10 @@ Spectrum VPPMIntegrator::LiDebug(Ray ray, Sampler& sampler)
                 continue;
             }
             // Estimate radiance
-            std::vector<Photon> gatheredPhotons;
-            m_photonPlane.Query(hitRec.m_geoRec.m_p, m_currentRadius, gatheredPhotons);
             Spectrum sum(0.f);
-            for (const auto& photon : gatheredPhotons) {
-                sum += photon.m_flux;
-            }
+            m_photonPlane[m_renderMap].Query(hitRec.m_geoRec.m_p, m_currentRadius, [&](const Photon& photon) {
+                sum += photon.Flux();
+            });
             float area = M_PI * m_currentRadius * m_currentRadius;
             radiance += sum / (area * m_deltaPhotonNum);
         }
@@ -3,11 +3,24 @@
 #include "core/integrator.h"
 
 #include "photon.h"
+#include "photonbvh.h"
+#include "photonbeam.h"
 
 #include <atomic>
 #include <thread>
 #include <mutex>
 
+// Point: photon points at a sampled collision (3D blur)
+// Beam: photon points along the whole camera segment (3D blur)
+// PointBeam: photon beams at a sampled collision (2D blur)
+// BeamBeam: photon beams along the whole camera segment (1D blur)
+enum class MediumEstimator {
+    Point,
+    Beam,
+    PointBeam,
+    BeamBeam
+};
+
 class VPPMIntegrator : public Integrator {
 public:
     VPPMIntegrator(
@@ -18,10 +31,13 @@ public:
         const uint32_t maxIteration,
         const uint32_t deltaPhotonNum,
         const float initialRadius,
-        const float alpha)
+        const float alpha,
+        const MediumEstimator mediumEstimator,
+        const uint32_t knn)
         : Integrator(scene, camera, buffer),
         m_maxBounce(maxBounce), m_maxIteration(maxIteration),
-        m_deltaPhotonNum(deltaPhotonNum), m_initialRadius(initialRadius), m_alpha(alpha) {}
+        m_deltaPhotonNum(deltaPhotonNum), m_initialRadius(initialRadius), m_alpha(alpha),
+        m_mediumEstimator(mediumEstimator), m_knn(knn) {}
 
     void Start();
     void Stop() { m_rendering = false; }
@@ -34,18 +50,33 @@ public:
     void Save();
     std::string ToString() const;
 private:
+    bool UsePhotonBeams() const {
+        return m_mediumEstimator == MediumEstimator::PointBeam || m_mediumEstimator == MediumEstimator::BeamBeam;
+    }
     void RenderTile(const Framebuffer::Tile& tile);
-    void EmitPhoton(const uint32_t& photonIndex);
-    Spectrum Li(Ray ray, Sampler& sampler);
+    // Gathers from _tree_ and returns the squared radius of the neighbourhood
+    template<typename Visitor>
+    float QueryPhotons(const KDTree& tree, const Float3& center, Visitor visitor) const;
+    // Emits and builds the photons of _iteration_ into photon maps iteration % 2
+    void PhotonPass(const uint32_t& iteration, const float& radius);
+    void EmitPhoton(const uint32_t& photonIndex, const uint32_t& iteration);
+    Spectrum Li(Ray ray, IndependentSampler& sampler);
     Spectrum EstimateMediumBeam3D(
         const Ray& ray,
-        const MediumRecord& mediumRec,
         const std::shared_ptr<PhaseFunction>& phase,
         Sampler& sampler);
     Spectrum EstimateMediumPoint3D(
         const Ray& ray,
         const MediumRecord& mediumRec,
         const std::shared_ptr<PhaseFunction>& phase);
+    Spectrum EstimateMediumBeam1D(
+        const Ray& ray,
+        const std::shared_ptr<PhaseFunction>& phase,
+        Sampler& sampler);
+    Spectrum EstimateMediumPoint2D(
+        const Ray& ray,
+        const MediumRecord& mediumRec,
+        const std::shared_ptr<PhaseFunction>& phase);
     Spectrum EstimatePlane(
         const Ray& ray,
         const HitRecord& hitRec,
@@ -60,15 +91,24 @@ private:
     uint32_t m_deltaPhotonNum;
     float m_initialRadius;
     float m_alpha;
+    MediumEstimator m_mediumEstimator;
+    // Photons per point estimate, 0 gathers within the current radius
+    uint32_t m_knn;
 
     // State
     uint32_t m_currentPhotonNum;
     uint32_t m_currentIteration;
     float m_currentRadius;
 
-    // Photons
-    KDTree m_photonPlane;
-    KDTree m_photonMedium;
+    // Photon maps read by the camera pass, the other ones are being filled
+    uint32_t m_renderMap = 0;
+
+    // Photons, double buffered so the photon pass of the next iteration
+    // runs alongside the camera pass of the current one
+    KDTree m_photonPlane[2];
+    KDTree m_photonMedium[2];
+    PhotonBVH m_photonMediumBVH[2];
+    PhotonBeamBVH m_photonBeams[2];
 
     // Muti-thread setting
     std::atomic<bool> m_rendering;
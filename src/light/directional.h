@@ -12,6 +12,8 @@ public:
     float Pdf(LightRecord& lightRec) const;
     Spectrum EvalPdf(LightRecord& lightRec) const;
     Spectrum SamplePhoton(Float2& s1, Float2& s2, Ray& ray) const;
+    bool IsDelta() const { return true; }
+    bool IsInfinite() const { return true; }
 private:
     Spectrum m_irrandance;
     Float3 m_direction;
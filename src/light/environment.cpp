@@ -1,5 +1,6 @@
 #include "environment.h"
 #include "core/framebuffer.h"
+#include "sampler/independent.h"
 
 EnvironmentLight::EnvironmentLight(
     const std::shared_ptr<Texture<Spectrum>>& texture, const float& radius, const float& scale)
@@ -77,7 +78,7 @@ void EnvironmentLight::TestSampling(const std::string& filename, const uint32_t&
         }
     }
 
-    Sampler sampler;
+    IndependentSampler sampler;
     for (uint32_t i = 0; i < sampleNum; i++) {
         float pdf;
         Float2 uv = m_distribution->Sample(sampler.Next2D(), pdf);
@@ -12,6 +12,7 @@ public:
     float Pdf(LightRecord& lightRec) const { return 0.f; }
     Spectrum EvalPdf(LightRecord& lightRec) const;
     Spectrum SamplePhoton(Float2& s1, Float2& s2, Ray& ray) const;
+    bool IsInfinite() const { return true; }
     // Test
     void TestSampling(const std::string& filename, const uint32_t& sampleNum) const;
 
@@ -6,6 +6,7 @@ Spectrum PointLight::Sample(LightRecord& lightRec, Float2& s) const
     Float3 dir = m_position - lightRec.m_ref;
     float dist = Length(dir);
     lightRec.m_wi = dir / dist;
+    lightRec.m_geoRec.m_p = m_position;
     lightRec.m_shadowRay = Ray(lightRec.m_ref, lightRec.m_wi, Ray::epsilon, dist * (1 - Ray::shadowEpsilon));
     return m_intensity / (dist * dist);
 }
@@ -12,6 +12,7 @@ public:
     float Pdf(LightRecord& lightRec) const;
     Spectrum EvalPdf(LightRecord& lightRec) const;
     Spectrum SamplePhoton(Float2& s1, Float2& s2, Ray& ray) const;
+    bool IsDelta() const { return true; }
 private:
     Spectrum m_intensity;
     Float3 m_position;
@@ -0,0 +1,163 @@
+#include "volume.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+VolumeLight::VolumeLight(
+    const std::shared_ptr<HeterogeneousMedium>& medium,
+    const uint32_t& blockSize,
+    const float& scale)
+    :Light(MediumInterface(medium, medium)), m_medium(medium), m_scale(scale),
+    m_blockSize(std::max(blockSize, 1u))
+{
+    LOG_IF(FATAL, !m_medium->m_blackbody) << "Volume light needs a blackbody medium.";
+    m_medium->m_hasVolumeLight = true;
+
+    // Trilinear lookups reach one voxel beyond the active bounding box
+    openvdb::CoordBBox bbox = m_medium->m_densityGrid->evalActiveVoxelBoundingBox();
+    Int3 indexMin(bbox.min().x() - 1, bbox.min().y() - 1, bbox.min().z() - 1);
+    Int3 indexMax(bbox.max().x() + 1, bbox.max().y() + 1, bbox.max().z() + 1);
+    m_origin = Float3(indexMin);
+    for (int axis = 0; axis < 3; axis++) {
+        int dim = indexMax[axis] - indexMin[axis] + 1;
+        m_resolution[axis] = (dim + m_blockSize - 1) / m_blockSize;
+    }
+    Float3 o = m_medium->IndexToWorld(Float3(0.f));
+    Float3 e0 = m_medium->IndexToWorld(Float3(1, 0, 0)) - o;
+    Float3 e1 = m_medium->IndexToWorld(Float3(0, 1, 0)) - o;
+    Float3 e2 = m_medium->IndexToWorld(Float3(0, 0, 1)) - o;
+    m_blockVolume = std::fabs(Dot(e0, Cross(e1, e2))) * m_blockSize * m_blockSize * m_blockSize;
+
+    // Power of every block from its voxel emission. Blocks whose lookups can
+    // reach a nonzero density keep a small floor so the pdf covers all emission
+    uint32_t blockNum = m_resolution.x * m_resolution.y * m_resolution.z;
+    std::vector<float> power(blockNum, 0.f);
+    std::vector<uint8_t> occupied(blockNum, 0);
+    auto job = [&](const tbb::blocked_range<uint32_t>& range) {
+        for (uint32_t idx = range.begin(); idx < range.end(); idx++) {
+            int bx = idx % m_resolution.x;
+            int by = (idx / m_resolution.x) % m_resolution.y;
+            int bz = idx / (m_resolution.x * m_resolution.y);
+            Float3 voxelMin = m_origin + Float3(bx, by, bz) * float(m_blockSize);
+            float sum = 0;
+            for (uint32_t z = 0; z <= m_blockSize; z++) {
+                for (uint32_t y = 0; y <= m_blockSize; y++) {
+                    for (uint32_t x = 0; x <= m_blockSize; x++) {
+                        Float3 pIndex = voxelMin + Float3(x, y, z);
+                        if (m_medium->DensityIndex(pIndex) <= 0) {
+                            continue;
+                        }
+                        occupied[idx] = 1;
+                        if (x < m_blockSize && y < m_blockSize && z < m_blockSize) {
+                            sum += m_medium->Emission(m_medium->IndexToWorld(pIndex)).Average();
+                        }
+                    }
+                }
+            }
+            power[idx] = sum;
+        }
+    };
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, blockNum), job);
+
+    double totalPower = 0;
+    uint32_t occupiedNum = 0;
+    for (uint32_t i = 0; i < blockNum; i++) {
+        totalPower += power[i];
+        occupiedNum += occupied[i];
+    }
+    LOG_IF(FATAL, occupiedNum == 0) << "Volume light without density.";
+    float floor = float(1e-3 * totalPower / occupiedNum);
+    if (floor == 0) {
+        floor = 1;
+    }
+    for (uint32_t i = 0; i < blockNum; i++) {
+        if (occupied[i]) {
+            power[i] = std::max(power[i], floor);
+        }
+    }
+    m_power.reset(new Distribution1D(power.data(), blockNum));
+    std::cout << "Volume light : " << m_resolution.x << 'x' << m_resolution.y << 'x' << m_resolution.z
+        << ", " << occupiedNum << " / " << blockNum << " emissive blocks" << std::endl;
+}
+
+Float3 VolumeLight::SamplePoint(const Float3& s, float& pdf) const
+{
+    uint32_t blockNum = m_power->m_func.size();
+    float blockPdf;
+    float u = m_power->Sample(s.x, blockPdf);
+    uint32_t idx = std::min(uint32_t(u), blockNum - 1);
+    // Probability of the block, Distribution1D returns the density over [0, 1)
+    pdf = blockPdf / blockNum / m_blockVolume;
+    // The remainder of the block choice is uniform inside the block
+    Float3 offset(u - idx, s.y, s.z);
+    int bx = idx % m_resolution.x;
+    int by = (idx / m_resolution.x) % m_resolution.y;
+    int bz = idx / (m_resolution.x * m_resolution.y);
+    Float3 pIndex = m_origin + (Float3(bx, by, bz) + offset) * float(m_blockSize);
+    return m_medium->IndexToWorld(pIndex);
+}
+
+Spectrum VolumeLight::Sample(LightRecord& lightRec, Float2& s) const
+{
+    LOG(FATAL) << "Volume light needs a third sample dimension.";
+    return Spectrum(0.f);
+}
+
+Spectrum VolumeLight::Sample(LightRecord& lightRec, Float2& s, Sampler& sampler) const
+{
+    float pdf;
+    Float3 p = SamplePoint(Float3(s.x, s.y, sampler.Next1D()), pdf);
+    Spectrum emission = m_medium->Emission(p) * m_scale;
+    Float3 dir = p - lightRec.m_ref;
+    float dist = Length(dir);
+    if (pdf == 0 || dist == 0 || emission.IsBlack()) {
+        lightRec.m_pdf = 0.f;
+        return Spectrum(0.f);
+    }
+    lightRec.m_geoRec.m_p = p;
+    lightRec.m_wi = dir / dist;
+    // dV = dist^2 * dOmega * dt
+    lightRec.m_pdf = pdf * dist * dist;
+    lightRec.m_volume = true;
+    lightRec.m_shadowRay = Ray(lightRec.m_ref, lightRec.m_wi, Ray::epsilon, dist * (1 - Ray::shadowEpsilon));
+    return emission / lightRec.m_pdf;
+}
+
+Spectrum VolumeLight::Eval(LightRecord& lightRec) const
+{
+    LOG(FATAL) << "No implementation.";
+    return Spectrum(0.f);
+}
+
+float VolumeLight::Pdf(LightRecord& lightRec) const
+{
+    LOG(FATAL) << "No implementation.";
+    return 0.0f;
+}
+
+Spectrum VolumeLight::EvalPdf(LightRecord& lightRec) const
+{
+    return Spectrum(0.f);
+}
+
+Spectrum VolumeLight::SamplePhoton(Float2& s1, Float2& s2, Ray& ray) const
+{
+    LOG(FATAL) << "Volume light needs a third sample dimension.";
+    return Spectrum(0.f);
+}
+
+Spectrum VolumeLight::SamplePhoton(Float2& s1, Float2& s2, Sampler& sampler, Ray& ray) const
+{
+    float pdf;
+    Float3 p = SamplePoint(Float3(s1.x, s1.y, sampler.Next1D()), pdf);
+    if (pdf == 0) {
+        return Spectrum(0.f);
+    }
+    // Isotropic emission
+    Float3 dir = SampleUniformSphere(s2);
+    float dirPdf = PdfUniformSphere(dir);
+
+    ray = Ray(p, dir, m_medium);
+
+    return m_medium->Emission(p) * m_scale / (pdf * dirPdf);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "core/primitive.h"
+#include "medium/heterogeneous.h"
+
+// Emissive heterogeneous medium as a light source. Blocks of the density
+// index space are importance sampled through a coarse power grid and points
+// are uniform inside the chosen block.
+class VolumeLight :public Light {
+public:
+    VolumeLight(
+        const std::shared_ptr<HeterogeneousMedium>& medium,
+        const uint32_t& blockSize,
+        const float& scale);
+
+    Spectrum Sample(LightRecord& lightRec, Float2& s) const;
+    Spectrum Eval(LightRecord& lightRec) const;
+    float Pdf(LightRecord& lightRec) const;
+    Spectrum EvalPdf(LightRecord& lightRec) const;
+    Spectrum SamplePhoton(Float2& s1, Float2& s2, Ray& ray) const;
+    // A point takes three dimensions, the third comes from _sampler_
+    Spectrum Sample(LightRecord& lightRec, Float2& s, Sampler& sampler) const;
+    Spectrum SamplePhoton(Float2& s1, Float2& s2, Sampler& sampler, Ray& ray) const;
+private:
+    // Point in world space and its pdf per unit volume
+    Float3 SamplePoint(const Float3& s, float& pdf) const;
+
+    std::shared_ptr<HeterogeneousMedium> m_medium;
+    float m_scale;
+    // Index space position of block (0, 0, 0)
+    Float3 m_origin;
+    Int3 m_resolution;
+    uint32_t m_blockSize;
+    float m_blockVolume;
+    std::unique_ptr<Distribution1D> m_power;
+};
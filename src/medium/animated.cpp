@@ -0,0 +1,126 @@
+#include "animated.h"
+
+AnimatedMedium::AnimatedMedium(
+    const std::shared_ptr<PhaseFunction>& pf,
+    const std::string& pattern,
+    const int& frameStart,
+    const int& frameEnd,
+    const uint32_t& cacheSize,
+    const FrameLoader& loader)
+    : Medium(pf), m_frameStart(frameStart), m_frameEnd(frameEnd), m_frame(frameStart - 1),
+    m_pattern(pattern), m_cacheSize(std::max(cacheSize, 2u)), m_loader(loader),
+    m_loading(frameStart - 1), m_exit(false)
+{
+    LOG_IF(FATAL, m_frameEnd < m_frameStart) << "Wrong frame range " << m_frameStart << " - " << m_frameEnd;
+    LOG_IF(FATAL, m_pattern.find('#') == std::string::npos) << "No frame number in " << m_pattern;
+    m_prefetchThread = std::thread([this]() { Prefetch(); });
+    SetFrame(m_frameStart);
+}
+
+AnimatedMedium::~AnimatedMedium()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_condition.notify_all();
+    if (m_prefetchThread.joinable()) {
+        m_prefetchThread.join();
+    }
+}
+
+std::string AnimatedMedium::FrameFilename(const int& frame) const
+{
+    size_t first = m_pattern.find('#');
+    size_t last = m_pattern.find_first_not_of('#', first);
+    size_t width = (last == std::string::npos ? m_pattern.size() : last) - first;
+    std::string number = std::to_string(frame);
+    if (number.size() < width) {
+        number = std::string(width - number.size(), '0') + number;
+    }
+    return m_pattern.substr(0, first) + number + m_pattern.substr(first + width);
+}
+
+void AnimatedMedium::SetFrame(const int& frame)
+{
+    LOG_IF(FATAL, frame < m_frameStart || frame > m_frameEnd) << "Frame " << frame << " out of range.";
+    std::unique_lock<std::mutex> lock(m_mutex);
+    std::shared_ptr<HeterogeneousMedium> medium = Find(frame);
+    if (!medium) {
+        // Jump the queue and wait for the prefetch thread
+        if (m_loading != frame) {
+            m_requests.push_front(frame);
+            m_condition.notify_all();
+        }
+        m_condition.wait(lock, [&]() { return (medium = Find(frame)) != nullptr; });
+    }
+    m_current = medium;
+    m_frame = frame;
+    // Decode the next frame while this one renders
+    if (frame + 1 <= m_frameEnd) {
+        Request(frame + 1);
+    }
+}
+
+std::shared_ptr<HeterogeneousMedium> AnimatedMedium::Find(const int& frame)
+{
+    for (auto iter = m_cache.begin(); iter != m_cache.end(); ++iter) {
+        if (iter->first == frame) {
+            m_cache.splice(m_cache.begin(), m_cache, iter);
+            return m_cache.front().second;
+        }
+    }
+    return nullptr;
+}
+
+void AnimatedMedium::Request(const int& frame)
+{
+    if (m_loading == frame || std::find(m_requests.begin(), m_requests.end(), frame) != m_requests.end()) {
+        return;
+    }
+    for (const auto& entry : m_cache) {
+        if (entry.first == frame) {
+            return;
+        }
+    }
+    m_requests.push_back(frame);
+    m_condition.notify_all();
+}
+
+void AnimatedMedium::Prefetch()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_condition.wait(lock, [this]() { return m_exit || !m_requests.empty(); });
+        if (m_exit) {
+            return;
+        }
+        int frame = m_requests.front();
+        m_requests.pop_front();
+        bool cached = false;
+        for (const auto& entry : m_cache) {
+            cached |= entry.first == frame;
+        }
+        if (cached) {
+            continue;
+        }
+
+        // Decode and bake without holding the lock
+        m_loading = frame;
+        lock.unlock();
+        std::shared_ptr<HeterogeneousMedium> medium = m_loader(FrameFilename(frame));
+        lock.lock();
+        m_loading = m_frameStart - 1;
+
+        m_cache.emplace_front(frame, medium);
+        // Evict least recently used frames, the rendering one stays
+        auto iter = m_cache.end();
+        while (m_cache.size() > m_cacheSize && iter != m_cache.begin()) {
+            --iter;
+            if (iter->second != m_current) {
+                iter = m_cache.erase(iter);
+            }
+        }
+        m_condition.notify_all();
+    }
+}
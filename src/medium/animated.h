@@ -0,0 +1,76 @@
+#pragma once
+
+#include "heterogeneous.h"
+
+#include <list>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// VDB sequence streamed frame by frame. Frame N + 1 is decoded and baked on a
+// background thread while frame N renders, baked frames stay in a bounded LRU.
+// The filename pattern marks the zero padded frame number with '#', e.g. fire_####.vdb
+class AnimatedMedium :public Medium {
+public:
+    typedef std::function<std::shared_ptr<HeterogeneousMedium>(const std::string&)> FrameLoader;
+
+    AnimatedMedium(
+        const std::shared_ptr<PhaseFunction>& pf,
+        const std::string& pattern,
+        const int& frameStart,
+        const int& frameEnd,
+        const uint32_t& cacheSize,
+        const FrameLoader& loader);
+    ~AnimatedMedium();
+
+    // Blocks until _frame_ is baked and prefetches the next one,
+    // must not be called while rendering
+    void SetFrame(const int& frame);
+
+    Spectrum Sample(const Ray& ray, MediumRecord& mediumRec, Sampler& sampler, const uint32_t& level = 0) const {
+        return m_current->Sample(ray, mediumRec, sampler, level);
+    }
+    Spectrum Transmittance(const Ray& ray, Sampler& sampler, const uint32_t& level = 0) const {
+        return m_current->Transmittance(ray, sampler, level);
+    }
+    Spectrum SigmaS(const Float3& p) const {
+        return m_current->SigmaS(p);
+    }
+    Spectrum SigmaT(const Float3& p) const {
+        return m_current->SigmaT(p);
+    }
+    float PdfDistance(const Ray& ray, const float& t, Sampler& sampler) const {
+        return m_current->PdfDistance(ray, t, sampler);
+    }
+    uint32_t SelectLevel(const uint32_t& depth, const Spectrum& throughput) const {
+        return m_current->SelectLevel(depth, throughput);
+    }
+
+    std::string FrameFilename(const int& frame) const;
+
+    int m_frameStart, m_frameEnd;
+    int m_frame;
+private:
+    typedef std::pair<int, std::shared_ptr<HeterogeneousMedium>> CacheEntry;
+
+    void Prefetch();
+    // Caller holds _m_mutex_
+    std::shared_ptr<HeterogeneousMedium> Find(const int& frame);
+    void Request(const int& frame);
+
+    std::string m_pattern;
+    uint32_t m_cacheSize;
+    FrameLoader m_loader;
+    std::shared_ptr<HeterogeneousMedium> m_current;
+
+    // Most recently used first
+    std::list<CacheEntry> m_cache;
+    std::deque<int> m_requests;
+    int m_loading;
+    bool m_exit;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::thread m_prefetchThread;
+};
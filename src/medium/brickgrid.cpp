@@ -0,0 +1,185 @@
+#include "brickgrid.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+static int FloorDiv8(const int& v)
+{
+    return v >= 0 ? v / 8 : -((-v + 7) / 8);
+}
+
+BrickGrid::BrickGrid(
+    const openvdb::FloatGrid& grid,
+    const uint32_t& channels,
+    const uint32_t& quantizationBits,
+    const std::function<void(const float&, float*)>& transform)
+    : m_channels(channels), m_quantizationBits(quantizationBits)
+{
+    LOG_IF(FATAL, m_quantizationBits != 8 && m_quantizationBits != 16 && m_quantizationBits != 32)
+        << "Wrong quantization bits " << m_quantizationBits;
+    LOG_IF(FATAL, m_channels != 1 && !transform) << "Multi-channel brick grid needs a transform";
+
+    // Bricks are aligned with VDB leaf nodes and cover the trilinear footprint
+    openvdb::CoordBBox bbox = grid.evalActiveVoxelBoundingBox();
+    Int3 brickMin, brickMax;
+    for (int axis = 0; axis < 3; axis++) {
+        brickMin[axis] = FloorDiv8(bbox.min()[axis] - 1);
+        brickMax[axis] = FloorDiv8(bbox.max()[axis] + 1);
+        m_origin[axis] = brickMin[axis] * brick_size;
+        m_resolution[axis] = brickMax[axis] - brickMin[axis] + 1;
+    }
+    size_t topNum = size_t(m_resolution.x) * m_resolution.y * m_resolution.z;
+    m_brickIndex.assign(topNum, 0);
+
+    // Mark bricks touched by active values (voxels or tiles)
+    for (auto iter = grid.cbeginValueOn(); iter; ++iter) {
+        openvdb::CoordBBox valueBBox;
+        iter.getBoundingBox(valueBBox);
+        Int3 b0, b1;
+        for (int axis = 0; axis < 3; axis++) {
+            b0[axis] = std::max(FloorDiv8(valueBBox.min()[axis]) - brickMin[axis], 0);
+            b1[axis] = std::min(FloorDiv8(valueBBox.max()[axis]) - brickMin[axis], m_resolution[axis] - 1);
+        }
+        for (int z = b0.z; z <= b1.z; z++) {
+            for (int y = b0.y; y <= b1.y; y++) {
+                for (int x = b0.x; x <= b1.x; x++) {
+                    m_brickIndex[BrickIndex(x, y, z)] = 1;
+                }
+            }
+        }
+    }
+
+    // Brick 0 is the empty brick
+    std::vector<Int3> bricks;
+    bricks.push_back(Int3(-1));
+    for (int z = 0; z < m_resolution.z; z++) {
+        for (int y = 0; y < m_resolution.y; y++) {
+            for (int x = 0; x < m_resolution.x; x++) {
+                uint32_t& idx = m_brickIndex[BrickIndex(x, y, z)];
+                if (idx) {
+                    idx = bricks.size();
+                    bricks.push_back(Int3(x, y, z));
+                }
+            }
+        }
+    }
+    m_brickNum = bricks.size();
+
+    // Values outside the active bricks read the grid background
+    m_background.resize(m_channels);
+    if (transform) {
+        transform(grid.background(), m_background.data());
+    }
+    else {
+        m_background[0] = grid.background();
+    }
+
+    size_t valueNum = size_t(m_brickNum) * m_channels * brick_voxels;
+    m_brickMin.assign(size_t(m_brickNum) * m_channels, 0.f);
+    m_brickScale.assign(size_t(m_brickNum) * m_channels, 0.f);
+    if (m_quantizationBits == 8) {
+        m_data8.assign(valueNum, 0);
+    }
+    else if (m_quantizationBits == 16) {
+        m_data16.assign(valueNum, 0);
+    }
+    else {
+        m_data32.assign(valueNum, 0.f);
+    }
+    for (uint32_t c = 0; c < m_channels; c++) {
+        m_brickMin[c] = m_background[c];
+        if (m_quantizationBits == 32) {
+            std::fill(m_data32.begin() + c * brick_voxels, m_data32.begin() + (c + 1) * brick_voxels, m_background[c]);
+        }
+    }
+
+    // Bake bricks in parallel, every task keeps its own accessor
+    auto bake = [&](const tbb::blocked_range<uint32_t>& range) {
+        auto accessor = grid.getConstAccessor();
+        std::vector<float> values(m_channels * brick_voxels);
+        std::vector<float> out(m_channels);
+        for (uint32_t brick = range.begin(); brick < range.end(); brick++) {
+            Int3 voxelMin = m_origin + bricks[brick] * brick_size;
+            for (int z = 0; z < brick_size; z++) {
+                for (int y = 0; y < brick_size; y++) {
+                    for (int x = 0; x < brick_size; x++) {
+                        float v = accessor.getValue(
+                            openvdb::Coord(voxelMin.x + x, voxelMin.y + y, voxelMin.z + z));
+                        uint32_t offset = Morton(x, y, z);
+                        if (transform) {
+                            transform(v, out.data());
+                            for (uint32_t c = 0; c < m_channels; c++) {
+                                values[c * brick_voxels + offset] = out[c];
+                            }
+                        }
+                        else {
+                            values[offset] = v;
+                        }
+                    }
+                }
+            }
+
+            for (uint32_t c = 0; c < m_channels; c++) {
+                const float* src = &values[c * brick_voxels];
+                size_t base = size_t(brick) * m_channels + c;
+                size_t dst = base * brick_voxels;
+                if (m_quantizationBits == 32) {
+                    std::copy(src, src + brick_voxels, m_data32.begin() + dst);
+                    continue;
+                }
+                float minVal = *std::min_element(src, src + brick_voxels);
+                float maxVal = *std::max_element(src, src + brick_voxels);
+                float levels = float((1u << m_quantizationBits) - 1);
+                float scale = (maxVal - minVal) / levels;
+                float invScale = scale == 0 ? 0 : 1.f / scale;
+                m_brickMin[base] = minVal;
+                m_brickScale[base] = scale;
+                for (int i = 0; i < brick_voxels; i++) {
+                    uint32_t q = uint32_t(std::min(levels, std::round((src[i] - minVal) * invScale)));
+                    if (m_quantizationBits == 8) {
+                        m_data8[dst + i] = uint8_t(q);
+                    }
+                    else {
+                        m_data16[dst + i] = uint16_t(q);
+                    }
+                }
+            }
+        }
+    };
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(1, m_brickNum), bake);
+
+    std::cout << "Brick grid : " << m_brickNum - 1 << " / " << topNum << " bricks, "
+        << m_quantizationBits << " bits, " << MemoryUsage() / (1024 * 1024) << " MB" << std::endl;
+}
+
+void BrickGrid::WidenMajorants(MajorantGrid& majorants) const
+{
+    if (m_quantizationBits == 32) {
+        return;
+    }
+    for (int z = 0; z < m_resolution.z; z++) {
+        for (int y = 0; y < m_resolution.y; y++) {
+            for (int x = 0; x < m_resolution.x; x++) {
+                uint32_t brick = m_brickIndex[BrickIndex(x, y, z)];
+                size_t base = size_t(brick) * m_channels;
+                if (brick == 0 || m_brickScale[base] == 0) {
+                    continue;
+                }
+                // Voxels decode within half a step, a full step also covers
+                // the float rounding. Voxels at the brick minimum decode
+                // exactly, so zero density only moves when the minimum is negative
+                Int3 voxelMin = m_origin + Int3(x, y, z) * brick_size;
+                majorants.Widen(voxelMin, voxelMin + Int3(brick_size - 1), m_brickScale[base], m_brickMin[base] < 0);
+            }
+        }
+    }
+}
+
+size_t BrickGrid::MemoryUsage() const
+{
+    return m_brickIndex.size() * sizeof(uint32_t) +
+        (m_brickMin.size() + m_brickScale.size()) * sizeof(float) +
+        m_data32.size() * sizeof(float) +
+        m_data16.size() * sizeof(uint16_t) +
+        m_data8.size() * sizeof(uint8_t);
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "core/vector.h"
+#include "majorant.h"
+
+#include <openvdb/openvdb.h>
+
+#include <immintrin.h>
+#include <functional>
+
+// Trilinear interpolation of 8 corners, v[dx + 2 * dy + 4 * dz]
+inline float TrilinearSSE(const float* v, const float& fx, const float& fy, const float& fz)
+{
+    __m128 lo = _mm_set_ps(v[6], v[4], v[2], v[0]);
+    __m128 hi = _mm_set_ps(v[7], v[5], v[3], v[1]);
+    // (y0z0, y1z0, y0z1, y1z1)
+    __m128 x = _mm_add_ps(lo, _mm_mul_ps(_mm_set1_ps(fx), _mm_sub_ps(hi, lo)));
+    __m128 y0 = _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 y1 = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 1, 3, 1));
+    // (z0, z1, z0, z1)
+    __m128 y = _mm_add_ps(y0, _mm_mul_ps(_mm_set1_ps(fy), _mm_sub_ps(y1, y0)));
+    float z0 = _mm_cvtss_f32(y);
+    float z1 = _mm_cvtss_f32(_mm_shuffle_ps(y, y, _MM_SHUFFLE(1, 1, 1, 1)));
+    return z0 + fz * (z1 - z0);
+}
+
+// Read-only sparse brick storage baked from a VDB grid.
+// 8^3 bricks aligned with the VDB leaf nodes are addressed through a flat
+// top-level index, voxels inside a brick are stored in Morton order and can
+// be quantized to 8 or 16 bits with a per brick offset and scale.
+// Brick 0 is the shared empty brick holding the grid background.
+class BrickGrid {
+public:
+    static constexpr int brick_size = 8;
+    static constexpr int brick_voxels = brick_size * brick_size * brick_size;
+
+    // _transform_ maps a grid value to _channels_ output values, it is also
+    // applied to the grid background
+    BrickGrid(
+        const openvdb::FloatGrid& grid,
+        const uint32_t& channels,
+        const uint32_t& quantizationBits,
+        const std::function<void(const float&, float*)>& transform = nullptr);
+
+    // Index space lookups, channel 0 and all channels
+    float Lookup(const Float3& pIndex) const {
+        uint32_t bricks[8], offsets[8];
+        float fx, fy, fz;
+        if (!Corners(pIndex, bricks, offsets, fx, fy, fz)) {
+            return m_background[0];
+        }
+        float v[8];
+        for (int i = 0; i < 8; i++) {
+            v[i] = Voxel(bricks[i], 0, offsets[i]);
+        }
+        return TrilinearSSE(v, fx, fy, fz);
+    }
+    void Lookup(const Float3& pIndex, float* values) const {
+        uint32_t bricks[8], offsets[8];
+        float fx, fy, fz;
+        if (!Corners(pIndex, bricks, offsets, fx, fy, fz)) {
+            std::copy(m_background.begin(), m_background.end(), values);
+            return;
+        }
+        for (uint32_t c = 0; c < m_channels; c++) {
+            float v[8];
+            for (int i = 0; i < 8; i++) {
+                v[i] = Voxel(bricks[i], c, offsets[i]);
+            }
+            values[c] = TrilinearSSE(v, fx, fy, fz);
+        }
+    }
+
+    // Loosens the channel 0 bounds of _majorants_, built from the same grid,
+    // by the quantization error of every brick
+    void WidenMajorants(MajorantGrid& majorants) const;
+
+    size_t MemoryUsage() const;
+
+    uint32_t m_channels;
+    uint32_t m_quantizationBits;
+    // Index space position of voxel (0, 0, 0) of brick (0, 0, 0)
+    Int3 m_origin;
+    Int3 m_resolution;
+    uint32_t m_brickNum;
+
+private:
+    static uint32_t Morton(const int& x, const int& y, const int& z) {
+        static const uint16_t spread[8] = { 0, 1, 8, 9, 64, 65, 72, 73 };
+        return spread[x] | (spread[y] << 1) | (spread[z] << 2);
+    }
+
+    bool Corners(
+        const Float3& pIndex,
+        uint32_t bricks[8],
+        uint32_t offsets[8],
+        float& fx, float& fy, float& fz) const
+    {
+        float px = pIndex.x - m_origin.x, py = pIndex.y - m_origin.y, pz = pIndex.z - m_origin.z;
+        float flx = std::floor(px), fly = std::floor(py), flz = std::floor(pz);
+        int x0 = int(flx), y0 = int(fly), z0 = int(flz);
+        if (x0 < 0 || y0 < 0 || z0 < 0 ||
+            x0 + 1 >= m_resolution.x * brick_size ||
+            y0 + 1 >= m_resolution.y * brick_size ||
+            z0 + 1 >= m_resolution.z * brick_size) {
+            return false;
+        }
+        fx = px - flx, fy = py - fly, fz = pz - flz;
+        int lx = x0 & 7, ly = y0 & 7, lz = z0 & 7;
+        if (lx != 7 && ly != 7 && lz != 7) {
+            // Common case, all corners inside one brick
+            uint32_t brick = m_brickIndex[BrickIndex(x0 >> 3, y0 >> 3, z0 >> 3)];
+            for (int i = 0; i < 8; i++) {
+                bricks[i] = brick;
+                offsets[i] = Morton(lx + (i & 1), ly + ((i >> 1) & 1), lz + (i >> 2));
+            }
+        }
+        else {
+            for (int i = 0; i < 8; i++) {
+                int x = x0 + (i & 1), y = y0 + ((i >> 1) & 1), z = z0 + (i >> 2);
+                bricks[i] = m_brickIndex[BrickIndex(x >> 3, y >> 3, z >> 3)];
+                offsets[i] = Morton(x & 7, y & 7, z & 7);
+            }
+        }
+        return true;
+    }
+
+    uint32_t BrickIndex(const int& bx, const int& by, const int& bz) const {
+        return (uint32_t(bz) * m_resolution.y + by) * m_resolution.x + bx;
+    }
+
+    float Voxel(const uint32_t& brick, const uint32_t& channel, const uint32_t& offset) const {
+        size_t base = size_t(brick) * m_channels + channel;
+        size_t idx = base * brick_voxels + offset;
+        switch (m_quantizationBits) {
+        case 8:
+            return m_brickMin[base] + m_brickScale[base] * m_data8[idx];
+        case 16:
+            return m_brickMin[base] + m_brickScale[base] * m_data16[idx];
+        default:
+            return m_data32[idx];
+        }
+    }
+
+    std::vector<uint32_t> m_brickIndex;
+    // Per channel value of the empty brick and of lookups outside the grid
+    std::vector<float> m_background;
+    // Per brick and channel dequantization
+    std::vector<float> m_brickMin, m_brickScale;
+    std::vector<float> m_data32;
+    std::vector<uint16_t> m_data16;
+    std::vector<uint8_t> m_data8;
+};
@@ -1,77 +1,65 @@
 #include "grid.h"
 
-Grid::Grid(
-    const std::string& filename, 
-    const std::string& grdiname, 
-    const float& scale)
-    : m_scale(scale)
-{
-    openvdb::initialize();
-    openvdb::io::File file(GetFileResolver()->string() + "/" + filename);
-    std::cout << "Loading " << filename << std::endl;
-
-    file.open();
-    openvdb::GridBase::Ptr baseGrid;
-    baseGrid = file.readGrid(grdiname);
-    file.close();
-
-    openvdb::FloatGrid::Ptr grid = openvdb::gridPtrCast<openvdb::FloatGrid>(baseGrid);
-    openvdb::tools::GridSampler<openvdb::FloatGrid, openvdb::tools::BoxSampler> sampler(*grid);
-
-    auto bboxDim = grid->evalActiveVoxelDim();
-    auto bbox = grid->evalActiveVoxelBoundingBox();
-    auto ws_min = grid->indexToWorld(bbox.min());
-    auto ws_max = grid->indexToWorld(bbox.max());
-
-    m_resolution = ULL3(bboxDim.x() - 1, bboxDim.y() - 1, bboxDim.z() - 1);
-    m_worldBounds = Bounds(Float3(ws_min.x(), ws_min.y(), ws_min.z()),
-        Float3(ws_max.x(), ws_max.y(), ws_max.z()));    
-    m_voxelLength = (m_worldBounds.m_pMax - m_worldBounds.m_pMin) / Float3(m_resolution);
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
 
+Grid::Grid(const openvdb::FloatGrid& grid, const bool& half)
+    : m_half(half), m_data32(nullptr), m_data16(nullptr)
+{
+    m_background = m_half ? RoundHalf(grid.background()) : grid.background();
+    // Trilinear lookups reach one voxel beyond the active bounding box
+    openvdb::CoordBBox bbox = grid.evalActiveVoxelBoundingBox();
+    m_origin = Int3(bbox.min().x() - 1, bbox.min().y() - 1, bbox.min().z() - 1);
+    for (int axis = 0; axis < 3; axis++) {
+        m_resolution[axis] = uint64_t(bbox.max()[axis] - bbox.min()[axis]) + 3;
+        m_tiles[axis] = (m_resolution[axis] + tile_size - 1) / tile_size;
+    }
+    m_voxelNum = size_t(m_tiles.x * m_tiles.y * m_tiles.z) * tile_voxels;
 
+    // 64 byte aligned, half storage keeps one spare element for the 32-bit gathers
+    if (m_half) {
+        m_data16 = (uint16_t*)_mm_malloc((m_voxelNum + 2) * sizeof(uint16_t), 64);
+        std::fill(m_data16, m_data16 + m_voxelNum + 2, uint16_t(0));
+    }
+    else {
+        m_data32 = (float*)_mm_malloc(m_voxelNum * sizeof(float), 64);
+        std::fill(m_data32, m_data32 + m_voxelNum, 0.f);
+    }
 
-    m_grid =std::unique_ptr<float[]>(new float[m_resolution.x * m_resolution.y * m_resolution.z]);
-    uint32_t idx = 0;
-    for (int k = bbox.min().z(); k < bbox.max().z(); ++k) {
-        for (int j = bbox.min().y(); j < bbox.max().y(); ++j) {
-            for (int i = bbox.min().x(); i < bbox.max().x(); ++i) {
-                float value = sampler.isSample(openvdb::Vec3R(i, j, k));
-                m_grid[idx++] = value;
+    // Bake z slices of tiles in parallel, every task keeps its own accessor
+    auto bake = [&](const tbb::blocked_range<uint64_t>& range) {
+        auto accessor = grid.getConstAccessor();
+        for (uint64_t tz = range.begin(); tz < range.end(); tz++) {
+            for (uint64_t z = tz * tile_size; z < std::min((tz + 1) * tile_size, m_resolution.z); z++) {
+                for (uint64_t y = 0; y < m_resolution.y; y++) {
+                    for (uint64_t x = 0; x < m_resolution.x; x++) {
+                        float v = accessor.getValue(openvdb::Coord(
+                            m_origin.x + int(x), m_origin.y + int(y), m_origin.z + int(z)));
+                        int64_t offset = Offset(x, y, z);
+                        if (m_half) {
+                            m_data16[offset] = FloatToHalf(v);
+                        }
+                        else {
+                            m_data32[offset] = v;
+                        }
+                    }
+                }
             }
         }
-    }
+    };
+    tbb::parallel_for(tbb::blocked_range<uint64_t>(0, m_tiles.z), bake);
+
+    std::cout << "Dense grid : " << m_resolution.x << 'x' << m_resolution.y << 'x' << m_resolution.z
+        << ", " << (m_half ? 16 : 32) << " bits, " << MemoryUsage() / (1024 * 1024) << " MB" << std::endl;
 }
 
-float Grid::LookUp(const Float3& pos) const
+Grid::~Grid()
 {
-    Float3 is_pos = (pos - m_worldBounds.m_pMin) / m_voxelLength;
-    Int3 p0 = Floor(is_pos), p1 = p0 + Int3(1, 1, 1);
-    int x0 = p0.x, y0 = p0.y, z0 = p0.z, x1 = p1.x, y1 = p1.y, z1 = p1.z;
-
-    if (x0 < 0 || y0 < 0 || z0 < 0 || 
-        x1 >= m_resolution.x || y1 >= m_resolution.y || z1 >= m_resolution.z) {
-        return 0;
-    }
-
-    float fx = is_pos.x - x0, fy = is_pos.y - y0, fz = is_pos.z - z0;
-
-    float d000 = GetVal(Int3(x0, y0, z0));
-    float d001 = GetVal(Int3(x1, y0, z0));
-    float d010 = GetVal(Int3(x0, y1, z0));
-    float d011 = GetVal(Int3(x1, y1, z0));
-    float d100 = GetVal(Int3(x0, y0, z1));
-    float d101 = GetVal(Int3(x1, y0, z1));
-    float d110 = GetVal(Int3(x0, y1, z1));
-    float d111 = GetVal(Int3(x1, y1, z1));
-    
-    float val = Lerp(
-        Lerp(Lerp(d000, d001, fx), Lerp(d010, d011, fx), fy),
-        Lerp(Lerp(d100, d101, fx), Lerp(d110, d111, fx), fy), fz);
-    return val * m_scale;
+    _mm_free(m_data32);
+    _mm_free(m_data16);
 }
 
-float Grid::GetVal(const Int3& p) const
+size_t Grid::MemoryUsage() const
 {
-    uint32_t idx = ((p.z * m_resolution.y) + p.y)* m_resolution.x + p.x;
-    return m_grid[idx];
+    return m_voxelNum * (m_half ? sizeof(uint16_t) : sizeof(float));
 }
@@ -1,25 +1,175 @@
 #pragma once
 
-#include "core/primitive.h"
+#include "core/vector.h"
 
 #include <openvdb/openvdb.h>
-#include <openvdb/tools/Interpolation.h>
-#include <openvdb/tools/ValueTransformer.h>
-#include <openvdb/tools/Dense.h>
 
+#include <immintrin.h>
+#include <cstring>
+
+// IEEE half conversions for the dense storage. Both paths round to nearest
+// even and keep denormals, so the result does not depend on F16C
+inline uint16_t FloatToHalf(const float& v)
+{
+#ifdef __F16C__
+    return uint16_t(_mm_cvtsi128_si32(_mm_cvtps_ph(_mm_set_ss(v), _MM_FROUND_TO_NEAREST_INT)));
+#else
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(float));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+    uint32_t h;
+    if (bits >= 0x47800000) {
+        // 2^16 and above overflow, NaN stays quiet NaN
+        h = bits > 0x7f800000 ? 0x7e00 : 0x7c00;
+    }
+    else if (bits < 0x38800000) {
+        // Half denormals, adding 0.5 shifts the mantissa in place and the
+        // float addition rounds to nearest even
+        const uint32_t magicBits = 126u << 23;
+        float f, magic;
+        std::memcpy(&f, &bits, sizeof(float));
+        std::memcpy(&magic, &magicBits, sizeof(float));
+        f += magic;
+        std::memcpy(&h, &f, sizeof(float));
+        h -= magicBits;
+    }
+    else {
+        // Rebias, round to nearest even, a carry moves into the exponent
+        uint32_t odd = (bits >> 13) & 1;
+        bits += ((15u - 127u) << 23) + 0xfff + odd;
+        h = bits >> 13;
+    }
+    return uint16_t(sign | h);
+#endif
+}
+
+inline float HalfToFloat(const uint16_t& h)
+{
+#ifdef __F16C__
+    return _mm_cvtss_f32(_mm_cvtph_ps(_mm_cvtsi32_si128(h)));
+#else
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+    float v;
+    if (exponent == 0) {
+        // Zero and denormals, mantissa * 2^-24 is exact
+        v = float(mantissa) * (1.f / 16777216.f);
+        return sign ? -v : v;
+    }
+    else if (exponent == 31) {
+        // Infinity, NaN is quieted like the hardware conversion
+        bits = sign | 0x7f800000 | (mantissa << 13) | (mantissa ? 0x400000 : 0);
+    }
+    else {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    std::memcpy(&v, &bits, sizeof(float));
+    return v;
+#endif
+}
+
+// Value the half storage returns for _v_
+inline float RoundHalf(const float& v)
+{
+    return HalfToFloat(FloatToHalf(v));
+}
+
+// Dense volume baked from the active region of a VDB grid. Voxels are stored
+// in 4^3 tiles (Morton order inside a tile) with 64-bit addressing, in 64 byte
+// aligned float or half storage. Lookups gather the 8 corners with AVX2.
 class Grid {
 public:
-    Grid(
-        const std::string& filename,
-        const std::string& grdiname,
-        const float& scale);
+    static constexpr int tile_size = 4;
+    static constexpr int tile_voxels = tile_size * tile_size * tile_size;
+
+    Grid(const openvdb::FloatGrid& grid, const bool& half);
+    // Owns aligned allocations
+    Grid(const Grid&) = delete;
+    Grid& operator=(const Grid&) = delete;
+    ~Grid();
 
-    float LookUp(const Float3& pos) const;
-    float GetVal(const Int3& p) const;
+    // Index space trilinear lookup, the grid background outside the grid
+    float Lookup(const Float3& pIndex) const {
+        float px = pIndex.x - m_origin.x, py = pIndex.y - m_origin.y, pz = pIndex.z - m_origin.z;
+        float flx = std::floor(px), fly = std::floor(py), flz = std::floor(pz);
+        int64_t x0 = int64_t(flx), y0 = int64_t(fly), z0 = int64_t(flz);
+        if (x0 < 0 || y0 < 0 || z0 < 0 ||
+            x0 + 1 >= int64_t(m_resolution.x) || y0 + 1 >= int64_t(m_resolution.y) ||
+            z0 + 1 >= int64_t(m_resolution.z)) {
+            return m_background;
+        }
+        float fx = px - flx, fy = py - fly, fz = pz - flz;
+        int64_t offsets[8];
+        for (int i = 0; i < 8; i++) {
+            offsets[i] = Offset(x0 + (i & 1), y0 + ((i >> 1) & 1), z0 + (i >> 2));
+        }
+#ifdef __AVX2__
+        __m256 v = Gather(offsets);
+        // Corner weights in the same order v[dx + 2 * dy + 4 * dz]
+        __m256 wx = _mm256_setr_ps(1 - fx, fx, 1 - fx, fx, 1 - fx, fx, 1 - fx, fx);
+        __m256 wy = _mm256_setr_ps(1 - fy, 1 - fy, fy, fy, 1 - fy, 1 - fy, fy, fy);
+        __m256 wz = _mm256_setr_ps(1 - fz, 1 - fz, 1 - fz, 1 - fz, fz, fz, fz, fz);
+        __m256 r = _mm256_mul_ps(v, _mm256_mul_ps(wx, _mm256_mul_ps(wy, wz)));
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(r), _mm256_extractf128_ps(r, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(s);
+#else
+        float v[8];
+        for (int i = 0; i < 8; i++) {
+            v[i] = Voxel(offsets[i]);
+        }
+        float x00 = v[0] + fx * (v[1] - v[0]), x10 = v[2] + fx * (v[3] - v[2]);
+        float x01 = v[4] + fx * (v[5] - v[4]), x11 = v[6] + fx * (v[7] - v[6]);
+        float xy0 = x00 + fy * (x10 - x00), xy1 = x01 + fy * (x11 - x01);
+        return xy0 + fz * (xy1 - xy0);
+#endif
+    }
 
-    float m_scale;
-    Bounds m_worldBounds;
+    size_t MemoryUsage() const;
+
+    bool m_half;
+    // As stored, so half storage rounds it like the voxels
+    float m_background;
+    // Index space position of voxel (0, 0, 0)
+    Int3 m_origin;
+    // Voxels, padded to whole tiles in m_tiles
     ULL3 m_resolution;
-    Float3 m_voxelLength;
-    std::unique_ptr<float[]> m_grid;
-};
\ No newline at end of file
+    ULL3 m_tiles;
+    size_t m_voxelNum;
+
+private:
+    int64_t Offset(const int64_t& x, const int64_t& y, const int64_t& z) const {
+        static const uint8_t spread[4] = { 0, 1, 8, 9 };
+        int64_t tile = (int64_t(z >> 2) * m_tiles.y + (y >> 2)) * m_tiles.x + (x >> 2);
+        return tile * tile_voxels + (spread[x & 3] | (spread[y & 3] << 1) | (spread[z & 3] << 2));
+    }
+
+    float Voxel(const int64_t& offset) const {
+        return m_half ? HalfToFloat(m_data16[offset]) : m_data32[offset];
+    }
+
+#ifdef __AVX2__
+    __m256 Gather(const int64_t offsets[8]) const {
+        __m256i lo = _mm256_loadu_si256((const __m256i*)offsets);
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(offsets + 4));
+        if (!m_half) {
+            __m128 vlo = _mm256_i64gather_ps(m_data32, lo, 4);
+            __m128 vhi = _mm256_i64gather_ps(m_data32, hi, 4);
+            return _mm256_set_m128(vhi, vlo);
+        }
+        // 32-bit gathers at 16-bit strides, the storage is padded for the last voxel
+        const int* base = (const int*)m_data16;
+        __m128i mask = _mm_set1_epi32(0xffff);
+        __m128i hlo = _mm_and_si128(_mm256_i64gather_epi32(base, lo, 2), mask);
+        __m128i hhi = _mm_and_si128(_mm256_i64gather_epi32(base, hi, 2), mask);
+        return _mm256_cvtph_ps(_mm_packus_epi32(hlo, hhi));
+    }
+#endif
+
+    float* m_data32;
+    uint16_t* m_data16;
+};
@@ -1,5 +1,40 @@
 #include "heterogeneous.h"
 
+#include "pcg32/pcg32.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_arena.h>
+
+#include <chrono>
+
+static int FloorDiv2(const int& v)
+{
+    return v >= 0 ? v / 2 : -((-v + 1) / 2);
+}
+
+// Halves the resolution with a box filter, voxel i of the result covers voxels
+// 2i and 2i + 1 of _grid_ along every axis
+static openvdb::FloatGrid::Ptr Downsample(const openvdb::FloatGrid& grid)
+{
+    openvdb::FloatGrid::Ptr coarse = openvdb::FloatGrid::create(0.f);
+    auto accessor = coarse->getAccessor();
+    for (auto iter = grid.cbeginValueOn(); iter; ++iter) {
+        float value = iter.getValue() * .125f;
+        openvdb::CoordBBox valueBBox;
+        iter.getBoundingBox(valueBBox);
+        for (int z = valueBBox.min().z(); z <= valueBBox.max().z(); z++) {
+            for (int y = valueBBox.min().y(); y <= valueBBox.max().y(); y++) {
+                for (int x = valueBBox.min().x(); x <= valueBBox.max().x(); x++) {
+                    openvdb::Coord parent(FloorDiv2(x), FloorDiv2(y), FloorDiv2(z));
+                    accessor.setValue(parent, accessor.getValue(parent) + value);
+                }
+            }
+        }
+    }
+    return coarse;
+}
+
 HeterogeneousMedium::HeterogeneousMedium(
     const std::shared_ptr<PhaseFunction>& pf, 
     const std::string& filename,
@@ -9,8 +44,16 @@ HeterogeneousMedium::HeterogeneousMedium(
     const std::string& temperatureName,
     const Spectrum& albedo,
     const float& scale,
-    const float& temperatureScale)
-    : Medium(pf), m_lefthand(lefthand), m_blackbody(blackbody), m_albedo(albedo), 
+    const float& temperatureScale,
+    const uint32_t& majorantBlockSize,
+    const std::string& storage,
+    const uint32_t& quantizationBits,
+    const std::string& estimator,
+    const bool& decomposition,
+    const uint32_t& mipLevels,
+    const uint32_t& mipDepth,
+    const float& mipThroughput)
+    : Medium(pf), m_decomposition(decomposition), m_mipDepth(mipDepth), m_mipThroughput(mipThroughput), m_lefthand(lefthand), m_blackbody(blackbody), m_albedo(albedo), 
     m_scale(scale), m_temperatureScale(temperatureScale),
     m_densitySampler({}), m_temperatureSampler({})
 {
@@ -19,122 +62,538 @@ HeterogeneousMedium::HeterogeneousMedium(
     std::cout << "Loading " << filename << std::endl;
 
     file.open();    
-    openvdb::GridBase::Ptr densityBaseGrid;
+    openvdb::GridBase::Ptr densityBaseGrid, temperatureBaseGrid;
     densityBaseGrid = file.readGrid(densityName);
     if (m_blackbody) {
-        openvdb::GridBase::Ptr temperatureBaseGrid;
-        temperatureBaseGrid = file.readGrid(densityName);
+        temperatureBaseGrid = file.readGrid(temperatureName);
     }
     file.close();
 
     m_densityGrid = openvdb::gridPtrCast<openvdb::FloatGrid>(densityBaseGrid);
     m_densitySampler = VDBFloatSampler(*m_densityGrid);
     if (m_blackbody) {
-        m_temperatureGrid = openvdb::gridPtrCast<openvdb::FloatGrid>(densityBaseGrid);
-        m_temperatureSampler = VDBFloatSampler(*m_densityGrid);
+        m_temperatureGrid = openvdb::gridPtrCast<openvdb::FloatGrid>(temperatureBaseGrid);
+        m_temperatureSampler = VDBFloatSampler(*m_temperatureGrid);
     }
 
+    m_densityAccessors.reset(new VDBThreadAccessors(
+        [this]() { return m_densityGrid->getConstAccessor(); }));
+
     m_densityGrid->evalMinMax(m_minDensity, m_maxDensity);
     m_invMaxDensity = m_maxDensity == 0 ? 0 : 1.f / m_maxDensity;
+    LOG_IF(FATAL, !m_densityGrid->transform().isLinear()) << "Only affine VDB transforms are supported.";
+    m_majorantGrid.reset(new MajorantGrid(*m_densityGrid, majorantBlockSize));
+
+    // Coarse levels spread density by up to one voxel of the coarsest level
+    openvdb::CoordBBox bbox = m_densityGrid->evalActiveVoxelBoundingBox();
+    int pad = 1 << mipLevels;
+    for (int i = 0; i < 8; i++) {
+        Float3 pIndex(
+            (i & 1) ? bbox.max().x() + pad : bbox.min().x() - pad,
+            (i & 2) ? bbox.max().y() + pad : bbox.min().y() - pad,
+            (i & 4) ? bbox.max().z() + pad : bbox.min().z() - pad);
+        m_worldBounds = Union(m_worldBounds, Bounds(IndexToWorld(pIndex)));
+    }
+    if (estimator == "delta") {
+        m_estimator = TransmittanceEstimator::Delta;
+    }
+    else if (estimator == "ratio") {
+        m_estimator = TransmittanceEstimator::Ratio;
+    }
+    else if (estimator == "residual_ratio") {
+        m_estimator = TransmittanceEstimator::ResidualRatio;
+    }
+    else {
+        LOG(FATAL) << "Wrong transmittance estimator " << estimator;
+    }
+
+    std::string densityStorage = storage;
+    if (storage == "auto") {
+        // Dense storage wins when the tree would mostly hold active leaves
+        const uint64_t maxDenseVoxels = uint64_t(1) << 27;
+        openvdb::Coord dim = bbox.dim();
+        uint64_t voxelNum = uint64_t(dim.x() + 2) * (dim.y() + 2) * (dim.z() + 2);
+        float occupancy = float(m_densityGrid->activeVoxelCount()) / voxelNum;
+        densityStorage = voxelNum <= maxDenseVoxels && occupancy >= .25f ? "dense" : "brick";
+        std::cout << "Density storage : " << densityStorage << ", occupancy " << occupancy << std::endl;
+    }
+    if (densityStorage == "brick") {
+        m_densityBricks.reset(new BrickGrid(*m_densityGrid, 1, quantizationBits));
+        // Bricks are quantized as a whole and don't line up with the majorant blocks
+        m_densityBricks->WidenMajorants(*m_majorantGrid);
+    }
+    else if (densityStorage == "dense") {
+        // Half floats for 16 bits and below
+        m_densityDense.reset(new Grid(*m_densityGrid, quantizationBits <= 16));
+        if (m_densityDense->m_half) {
+            // Trilinear lookups stay within the rounded corner values
+            m_majorantGrid->Round(RoundHalf);
+            m_minDensity = RoundHalf(m_minDensity);
+            m_maxDensity = RoundHalf(m_maxDensity);
+            m_invMaxDensity = m_maxDensity == 0 ? 0 : 1.f / m_maxDensity;
+        }
+    }
+    else {
+        LOG_IF(FATAL, densityStorage != "vdb") << "Wrong density storage " << storage;
+    }
+    for (uint32_t level = 1; level <= mipLevels; level++) {
+        const openvdb::FloatGrid& fine = level == 1 ? *m_densityGrid : *m_mipLevels.back().m_grid;
+        MipLevel mip;
+        mip.m_grid = Downsample(fine);
+        mip.m_bricks.reset(new BrickGrid(*mip.m_grid, 1, quantizationBits));
+        // Same world space block size as level 0
+        mip.m_majorantGrid.reset(new MajorantGrid(*mip.m_grid, std::max(majorantBlockSize >> level, 1u)));
+        mip.m_bricks->WidenMajorants(*mip.m_majorantGrid);
+        m_mipLevels.push_back(std::move(mip));
+    }
+    if (m_blackbody) {
+        // Planck's law is evaluated once per voxel instead of per lookup
+        std::cout << "Baking emission" << std::endl;
+        m_emissionBricks.reset(new BrickGrid(*m_temperatureGrid, 3, quantizationBits,
+            [this](const float& T, float* Le) {
+                Spectrum radiance = BlackBody(T * m_temperatureScale);
+                Le[0] = radiance.r;
+                Le[1] = radiance.g;
+                Le[2] = radiance.b;
+            }));
+    }
+}
+
+// Chooses a collision type with probabilities proportional to the
+// throughput weighted channel average, spectral tracking (Kutz et al. 2017)
+static int SampleSpectralEvent(
+    const Spectrum& weight,
+    const Spectrum sigma[3],
+    const float& u,
+    float& pdf)
+{
+    float p[3];
+    for (int i = 0; i < 3; i++) {
+        p[i] = (weight * sigma[i]).Average();
+    }
+    float sum = p[0] + p[1] + p[2];
+    if (sum == 0) {
+        pdf = 0;
+        return 0;
+    }
+    float target = u * sum;
+    int event = target < p[0] ? 0 : (target < p[0] + p[1] ? 1 : 2);
+    // Guard against rounding picking a zero probability event
+    while (p[event] == 0) {
+        event = (event + 2) % 3;
+    }
+    pdf = p[event] / sum;
+    return event;
+}
 
-    //m_dG = std::shared_ptr<Grid>(new Grid(filename, densityName, 1));
-    //std::cout << m_minVal << ' ' << m_maxVal << std::endl;
+Spectrum HeterogeneousMedium::Collide(
+    const int& event,
+    const Float3& p,
+    const float& t,
+    MediumRecord& mediumRec,
+    const Spectrum& weight) const
+{
+    mediumRec.m_p = p;
+    mediumRec.m_t = t;
+    mediumRec.m_pdf = 0;
+    mediumRec.m_internal = true;
+    if (event == 0) {
+        // Scatter
+        return weight;
+    }
+    // Absorb, emitters end the path with their radiance
+    if (m_blackbody) {
+        mediumRec.m_Le = BlackbodyRadiance(p);
+    }
+    return mediumRec.m_Le.IsBlack() ? Spectrum(0.f) : weight;
 }
 
-Spectrum HeterogeneousMedium::Sample(const Ray& ray, MediumRecord& mediumRec, Sampler& sampler) const
+Spectrum HeterogeneousMedium::Sample(const Ray& ray, MediumRecord& mediumRec, Sampler& sampler, const uint32_t& _level) const
 {
+    uint32_t level = std::min(_level, uint32_t(m_mipLevels.size()));
     float d = ray.tMax;
     LOG_IF(FATAL, d == std::numeric_limits<float>::infinity()) << "The estimated ray is infinity.";
-    float t = 0;
-    float pdf = 1;
-    float Tr = 1;
 
-    mediumRec.m_internal = true;
-    float s;
-    while (true) {
-        s = sampler.Next1D();
-        t -= std::log(1 - s) * m_invMaxDensity / m_scale;
-        // Outside the medium
-        if (t >= d) {
-            mediumRec.m_p = ray(d);
-            mediumRec.m_t = d;
-            mediumRec.m_pdf = 0;
-            mediumRec.m_internal = false;
-            break;
-        }
-        // Get _sigma_a_, _sigma_s_
-        float density = Density(ray(t));
-        float sigma_s = density * m_albedo.r;
-        float sigma_a = density * std::max(0.f, 1 - m_albedo.r);
-        float sigma_n = m_maxDensity - density;
-        pdf *= 1 - density * m_invMaxDensity;
-        // Sample particle's kind
-        int mod = SampleDiscrete({ sigma_s, sigma_a, sigma_n }, sampler.Next1D());
-        if (mod == 0) {
-            // Scatter
-            mediumRec.m_p = ray(t);
-            mediumRec.m_t = t;
-            mediumRec.m_pdf = 0;
-            mediumRec.m_internal = true;
-            return m_albedo;
-        }
-        else if (mod == 1) {
-            // Absorb
-            //mediumRec.m_Le = BlackbodyRadiance(ray(t));
-        }
-        else if (mod == 2) {
-            // Null
+    Spectrum scatter = m_albedo;
+    Spectrum absorb = ClampNegative(Spectrum(1.f) - m_albedo);
+    Spectrum weight(1.f);
+    float tMin, tMax;
+    if (ClipRay(ray, tMin, tMax)) {
+        Float3 o, dir;
+        WorldToIndex(ray, o, dir);
+        // Track every block against its own bounds, the exponential is
+        // memoryless so every segment restarts at its entry
+        MajorantIterator iter(LevelRay(level, o, dir), o, dir, tMin, tMax);
+        MajorantSegment seg;
+        while (iter.Next(seg)) {
+            if (seg.m_majorant == 0) {
+                continue;
+            }
+            // Decomposition tracking, the block minorant is a homogeneous
+            // control component sampled analytically, the residual is tracked
+            float control = m_decomposition ? seg.m_minorant : 0.f;
+            float residual = seg.m_majorant - control;
+            float tControl = std::numeric_limits<float>::infinity();
+            if (control > 0) {
+                tControl = seg.m_tMin - std::log(1 - sampler.Next1D()) / (control * m_scale);
+            }
+            float tEnd = std::min(tControl, seg.m_tMax);
+
+            if (residual > 0) {
+                float invResidual = 1.f / (residual * m_scale);
+                float t = seg.m_tMin;
+                while (true) {
+                    t -= std::log(1 - sampler.Next1D()) * invResidual;
+                    if (t >= tEnd) {
+                        break;
+                    }
+                    // Get residual _sigma_s_, _sigma_a_, _sigma_n_ in units of density
+                    float density = DensityLevel(o + dir * t, level);
+                    float sigma_r = std::max(0.f, density - control);
+                    Spectrum sigma[3] = {
+                        scatter * sigma_r,
+                        absorb * sigma_r,
+                        Spectrum(std::max(0.f, seg.m_majorant - density)) };
+                    float pdf;
+                    int event = SampleSpectralEvent(weight, sigma, sampler.Next1D(), pdf);
+                    if (pdf == 0) {
+                        return Spectrum(0.f);
+                    }
+                    weight *= sigma[event] / (residual * pdf);
+                    if (event != 2) {
+                        return Collide(event, ray(t), t, mediumRec, weight);
+                    }
+                }
+            }
+
+            if (tControl < seg.m_tMax) {
+                // Control collisions are real, choose scatter or absorb
+                Spectrum sigma[3] = { scatter, absorb, Spectrum(0.f) };
+                float pdf;
+                int event = SampleSpectralEvent(weight, sigma, sampler.Next1D(), pdf);
+                if (pdf == 0) {
+                    return Spectrum(0.f);
+                }
+                weight *= sigma[event] / pdf;
+                return Collide(event, ray(tControl), tControl, mediumRec, weight);
+            }
         }
-        else {
-            
+    }
+
+    // Outside the medium
+    mediumRec.m_p = ray(d);
+    mediumRec.m_t = d;
+    mediumRec.m_pdf = 0;
+    mediumRec.m_internal = false;
+    return weight;
+}
+
+// Roulette low transmittance estimates, return false if terminated
+static bool TransmittanceRoulette(float& T, Sampler& sampler)
+{
+    const float rrThreshold = .1;
+    if (T < rrThreshold) {
+        float q = std::max((float).05, 1 - T);
+        if (sampler.Next1D() < q) {
+            return false;
         }
+        T /= 1 - q;
     }
-    return Spectrum(1.f);
+    return true;
 }
 
-Spectrum HeterogeneousMedium::Transmittance(const Ray& ray, Sampler& sampler) const
+Spectrum HeterogeneousMedium::Transmittance(const Ray& ray, Sampler& sampler, const uint32_t& _level) const
 {
+    uint32_t level = std::min(_level, uint32_t(m_mipLevels.size()));
     float d = ray.tMax;
     LOG_IF(FATAL, d == std::numeric_limits<float>::infinity()) << "The estimated ray is infinity.";
-    float t = 0;
     float T = 1;
-    
-    
-    while (true) {        
-        float s = sampler.Next1D();
-        t -= std::log(1 - s) * m_invMaxDensity / m_scale;
-        if (t >= d) break;
-        float density = Density(ray(t));
-        T *= (1 - density * m_invMaxDensity);
-
-        const float rrThreshold = .1;
-        if (T < rrThreshold) {
-            float q = std::max((float).05, 1 - T);
-            if (sampler.Next1D() < q) {
-                return Spectrum(0.);
+
+    float tMin, tMax;
+    if (!ClipRay(ray, tMin, tMax)) {
+        return Spectrum(1.f);
+    }
+    Float3 o, dir;
+    WorldToIndex(ray, o, dir);
+    // Track every block against its own bounds, empty blocks are skipped
+    MajorantIterator iter(LevelRay(level, o, dir), o, dir, tMin, tMax);
+    MajorantSegment seg;
+    while (iter.Next(seg)) {
+        if (seg.m_majorant == 0) {
+            continue;
+        }
+        if (m_estimator == TransmittanceEstimator::Delta) {
+            // Binary estimate, stop at the first real collision
+            float invMajorant = 1.f / (seg.m_majorant * m_scale);
+            float t = seg.m_tMin;
+            while (true) {
+                t -= std::log(1 - sampler.Next1D()) * invMajorant;
+                if (t >= seg.m_tMax) {
+                    break;
+                }
+                float density = DensityLevel(o + dir * t, level);
+                if (sampler.Next1D() * seg.m_majorant < density) {
+                    return Spectrum(0.f);
+                }
+            }
+        }
+        else if (m_estimator == TransmittanceEstimator::Ratio) {
+            float invMajorant = 1.f / (seg.m_majorant * m_scale);
+            float t = seg.m_tMin;
+            while (true) {
+                t -= std::log(1 - sampler.Next1D()) * invMajorant;
+                if (t >= seg.m_tMax) {
+                    break;
+                }
+                float density = DensityLevel(o + dir * t, level);
+                T *= (1 - density / seg.m_majorant);
+                if (!TransmittanceRoulette(T, sampler)) {
+                    return Spectrum(0.f);
+                }
+            }
+        }
+        else {
+            // Residual ratio tracking (Novak et al. 2014), the minorant is the
+            // control density and only the residual is tracked
+            float control = seg.m_minorant;
+            float residual = seg.m_majorant - control;
+            T *= std::exp(-control * m_scale * (seg.m_tMax - seg.m_tMin));
+            if (residual > 0) {
+                float invResidual = 1.f / (residual * m_scale);
+                float t = seg.m_tMin;
+                while (true) {
+                    t -= std::log(1 - sampler.Next1D()) * invResidual;
+                    if (t >= seg.m_tMax) {
+                        break;
+                    }
+                    float density = DensityLevel(o + dir * t, level);
+                    T *= (1 - (density - control) / residual);
+                }
+            }
+            if (!TransmittanceRoulette(T, sampler)) {
+                return Spectrum(0.f);
             }
-            T /= 1 - q;
         }
     }
 
     return T;
 }
 
-float HeterogeneousMedium::Density(const Float3& _pWorld) const
+Spectrum HeterogeneousMedium::SigmaS(const Float3& p) const
+{
+    return m_albedo * Density(p) * m_scale;
+}
+
+Spectrum HeterogeneousMedium::SigmaT(const Float3& p) const
+{
+    return Spectrum(Density(p) * m_scale);
+}
+
+float HeterogeneousMedium::PdfDistance(const Ray& ray, const float& t, Sampler& sampler) const
+{
+    // sigma_t(t) * Tr(0, t). MIS weights need the same pdf every time it is
+    // evaluated, so the optical depth is integrated deterministically with a
+    // midpoint sample per voxel, skipping empty majorant blocks
+    Ray segment(ray.o, ray.d, 0, t);
+    float tau = 0;
+    float tMin, tMax;
+    if (ClipRay(segment, tMin, tMax)) {
+        Float3 o, dir;
+        WorldToIndex(segment, o, dir);
+        float voxelPerT = Length(dir);
+        MajorantIterator iter(LevelRay(0, o, dir), o, dir, tMin, tMax);
+        MajorantSegment seg;
+        while (iter.Next(seg)) {
+            if (seg.m_majorant == 0) {
+                continue;
+            }
+            float length = seg.m_tMax - seg.m_tMin;
+            int stepNum = std::max(int(std::ceil(length * voxelPerT)), 1);
+            float step = length / stepNum;
+            for (int i = 0; i < stepNum; i++) {
+                tau += DensityLevel(o + dir * (seg.m_tMin + (i + .5f) * step), 0) * step;
+            }
+        }
+    }
+    return Density(ray(t)) * m_scale * std::exp(-tau * m_scale);
+}
+
+float HeterogeneousMedium::Density(const Float3& pWorld) const
+{
+    if (!m_worldBounds.Contain(pWorld)) {
+        return 0.f;
+    }
+    return DensityIndex(WorldToIndex(pWorld));
+}
+
+Float3 HeterogeneousMedium::WorldToIndex(const Float3& _pWorld) const
 {
     openvdb::Vec3d pWorld;
     if (m_lefthand) {
         pWorld = openvdb::Vec3d(_pWorld.x, _pWorld.z, -_pWorld.y);
-        //a = m_dG->LookUp(Float3(_pWorld.x, _pWorld.z, -_pWorld.y));
-        //return m_dG->LookUp(Float3(_pWorld.x, _pWorld.z, -_pWorld.y));
     }
-    else {        
+    else {
         pWorld = openvdb::Vec3d(_pWorld.x, _pWorld.y, _pWorld.z);
-        //a = m_dG->LookUp(Float3(_pWorld.x, _pWorld.y, _pWorld.z));
-        //return m_dG->LookUp(Float3(_pWorld.x, _pWorld.y, _pWorld.z));
     }
-    float ret = m_densitySampler.wsSample(pWorld);
-    return ret;
+    openvdb::Vec3d pIndex = m_densityGrid->transform().worldToIndex(pWorld);
+    return Float3(pIndex.x(), pIndex.y(), pIndex.z());
+}
+
+Float3 HeterogeneousMedium::IndexToWorld(const Float3& pIndex) const
+{
+    openvdb::Vec3d pWorld = m_densityGrid->transform().indexToWorld(openvdb::Vec3d(pIndex.x, pIndex.y, pIndex.z));
+    if (m_lefthand) {
+        return Float3(pWorld.x(), -pWorld.z(), pWorld.y());
+    }
+    else {
+        return Float3(pWorld.x(), pWorld.y(), pWorld.z());
+    }
+}
+
+bool HeterogeneousMedium::ClipRay(const Ray& ray, float& tMin, float& tMax) const
+{
+    if (!m_worldBounds.Intersect(ray, tMin, tMax)) {
+        return false;
+    }
+    tMin = std::max(tMin, 0.f);
+    tMax = std::min(tMax, ray.tMax);
+    return tMin < tMax;
+}
+
+void HeterogeneousMedium::WorldToIndex(const Ray& ray, Float3& o, Float3& d) const
+{
+    // Affine map keeps the ray parameter t
+    o = WorldToIndex(ray.o);
+    d = WorldToIndex(ray.o + ray.d) - o;
+}
+
+uint32_t HeterogeneousMedium::SelectLevel(const uint32_t& depth, const Spectrum& throughput) const
+{
+    if (m_mipLevels.empty()) {
+        return 0;
+    }
+    uint32_t level = depth >= m_mipDepth ? depth - m_mipDepth + 1 : 0;
+    float maxThroughput = MaxComponent(throughput);
+    if (m_mipThroughput > 0 && maxThroughput < m_mipThroughput) {
+        level = std::max(level, 1 + uint32_t(std::log2(m_mipThroughput / std::max(maxThroughput, 1e-8f))));
+    }
+    return std::min(level, uint32_t(m_mipLevels.size()));
+}
+
+const MajorantGrid& HeterogeneousMedium::LevelRay(const uint32_t& level, Float3& o, Float3& d) const
+{
+    if (level == 0) {
+        return *m_majorantGrid;
+    }
+    // Voxel centers of level l sit at (i + 0.5) * 2^l - 0.5 in level 0
+    float invScale = 1.f / float(1 << level);
+    o = (o + Float3(.5f)) * invScale - Float3(.5f);
+    d = d * invScale;
+    return *m_mipLevels[level - 1].m_majorantGrid;
+}
+
+float HeterogeneousMedium::DensityLevel(const Float3& pLevel, const uint32_t& level) const
+{
+    if (level == 0) {
+        return DensityIndex(pLevel);
+    }
+    return m_mipLevels[level - 1].m_bricks->Lookup(pLevel);
+}
+
+float HeterogeneousMedium::DensityIndex(const Float3& pIndex) const
+{
+    if (m_densityDense) {
+        return m_densityDense->Lookup(pIndex);
+    }
+    if (m_densityBricks) {
+        return m_densityBricks->Lookup(pIndex);
+    }
+    float density;
+    openvdb::tools::BoxSampler::sample(m_densityAccessors->local(),
+        openvdb::Vec3R(pIndex.x, pIndex.y, pIndex.z), density);
+    return density;
+}
+
+void HeterogeneousMedium::Benchmark() const
+{
+    // Coherent lookups along random rays through the active region, like tracking
+    const uint32_t rayNum = 1 << 16, stepNum = 64;
+    openvdb::CoordBBox bbox = m_densityGrid->evalActiveVoxelBoundingBox();
+    Float3 pMin(bbox.min().x(), bbox.min().y(), bbox.min().z());
+    Float3 pMax(bbox.max().x(), bbox.max().y(), bbox.max().z());
+    std::vector<Float3> points(size_t(rayNum) * stepNum);
+    pcg32 rng;
+    for (uint32_t i = 0; i < rayNum; i++) {
+        Float3 p = pMin + (pMax - pMin) * Float3(rng.nextFloat(), rng.nextFloat(), rng.nextFloat());
+        Float3 d = SampleUniformSphere(Float2(rng.nextFloat(), rng.nextFloat()));
+        for (uint32_t j = 0; j < stepNum; j++) {
+            points[i * stepNum + j] = p + d * (0.5f * j);
+        }
+    }
+
+    // Quantized storage must stay within the bounds it is tracked against
+    for (uint32_t level = 0; level <= m_mipLevels.size(); level++) {
+        uint32_t outside = 0;
+        for (const Float3& p : points) {
+            Float3 o = p, d(0.f);
+            const MajorantGrid& grid = LevelRay(level, o, d);
+            Float3 b = (o - grid.m_origin) / float(grid.m_blockSize);
+            Int3 block(int(std::floor(b.x)), int(std::floor(b.y)), int(std::floor(b.z)));
+            if (block.x < 0 || block.y < 0 || block.z < 0 || block.x >= grid.m_resolution.x ||
+                block.y >= grid.m_resolution.y || block.z >= grid.m_resolution.z) {
+                continue;
+            }
+            float density = DensityLevel(o, level);
+            float majorant = grid.Majorant(block);
+            float eps = 1e-5f * std::max(majorant, 1.f);
+            outside += density > majorant + eps || density < grid.Minorant(block) - eps;
+        }
+        LOG_IF(FATAL, outside > 0) << outside << " density lookups outside the majorants at level " << level;
+    }
+
+    auto run = [&](const std::string& name, auto lookup) {
+        uint32_t maxThreadNum = std::thread::hardware_concurrency();
+        for (uint32_t threadNum = 1; threadNum <= maxThreadNum; threadNum *= 2) {
+            std::atomic<uint32_t> nonzero(0);
+            tbb::task_arena arena(threadNum);
+            auto start = std::chrono::steady_clock::now();
+            arena.execute([&]() {
+                tbb::parallel_for(tbb::blocked_range<uint32_t>(0, rayNum),
+                    [&](const tbb::blocked_range<uint32_t>& range) {
+                        float sum = 0;
+                        for (uint32_t i = range.begin(); i < range.end(); i++) {
+                            for (uint32_t j = 0; j < stepNum; j++) {
+                                sum += lookup(points[i * stepNum + j]);
+                            }
+                        }
+                        nonzero += sum > 0;
+                    });
+            });
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+            std::cout << name << " threads : " << threadNum << ", "
+                << points.size() / seconds.count() * 1e-6 << " M lookups/s" << std::endl;
+        }
+    };
+
+    std::cout << "Benchmark density lookups" << std::endl;
+    run("Shared sampler", [this](const Float3& p) {
+        return m_densitySampler.isSample(openvdb::Vec3R(p.x, p.y, p.z));
+    });
+    run("Thread accessor", [this](const Float3& p) {
+        float density;
+        openvdb::tools::BoxSampler::sample(m_densityAccessors->local(), openvdb::Vec3R(p.x, p.y, p.z), density);
+        return density;
+    });
+    if (m_densityBricks) {
+        run("Brick grid", [this](const Float3& p) {
+            return m_densityBricks->Lookup(p);
+        });
+    }
+    if (m_densityDense) {
+        run("Dense grid", [this](const Float3& p) {
+            return m_densityDense->Lookup(p);
+        });
+    }
 }
 
 Spectrum HeterogeneousMedium::BlackbodyRadiance(const Float3& _pWorld) const
@@ -146,7 +605,21 @@ Spectrum HeterogeneousMedium::BlackbodyRadiance(const Float3& _pWorld) const
     else {
         pWorld = openvdb::Vec3d(_pWorld.x, _pWorld.y, _pWorld.z);
     }
-    float T = m_temperatureSampler.wsSample(pWorld);
-    T *= m_temperatureScale;
-    return BlackBody(T);
+    openvdb::Vec3d pIndex = m_temperatureGrid->transform().worldToIndex(pWorld);
+    float Le[3];
+    m_emissionBricks->Lookup(Float3(pIndex.x(), pIndex.y(), pIndex.z()), Le);
+    return Spectrum(Le);
+}
+
+Spectrum HeterogeneousMedium::Emission(const Float3& p) const
+{
+    if (!m_blackbody) {
+        return Spectrum(0.f);
+    }
+    float density = Density(p);
+    if (density == 0) {
+        return Spectrum(0.f);
+    }
+    Spectrum sigma_a = ClampNegative(Spectrum(1.f) - m_albedo) * (density * m_scale);
+    return sigma_a * BlackbodyRadiance(p);
 }
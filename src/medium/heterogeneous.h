@@ -3,12 +3,22 @@
 #include "core/primitive.h"
 
 #include "grid.h"
+#include "majorant.h"
+#include "brickgrid.h"
 
 #include <openvdb/openvdb.h>
 #include <openvdb/tools/Interpolation.h>
 #include <openvdb/tools/ValueTransformer.h>
 #include <openvdb/tools/Dense.h>
 
+#include <tbb/enumerable_thread_specific.h>
+
+enum class TransmittanceEstimator {
+    Delta,
+    Ratio,
+    ResidualRatio
+};
+
 class HeterogeneousMedium :public Medium {
 public:
     HeterogeneousMedium(
@@ -20,13 +30,50 @@ public:
         const std::string& temperatureName,
         const Spectrum& albedo,
         const float& scale,
-        const float& temperatureScale);
+        const float& temperatureScale,
+        const uint32_t& majorantBlockSize,
+        const std::string& storage,
+        const uint32_t& quantizationBits,
+        const std::string& estimator,
+        const bool& decomposition,
+        const uint32_t& mipLevels,
+        const uint32_t& mipDepth,
+        const float& mipThroughput);
 
-    Spectrum Sample(const Ray& ray, MediumRecord& mediumRec, Sampler& sampler) const;
-    Spectrum Transmittance(const Ray& ray, Sampler& sampler) const;
+    Spectrum Sample(const Ray& ray, MediumRecord& mediumRec, Sampler& sampler, const uint32_t& level = 0) const;
+    Spectrum Transmittance(const Ray& ray, Sampler& sampler, const uint32_t& level = 0) const;
+    Spectrum SigmaS(const Float3& p) const;
+    Spectrum SigmaT(const Float3& p) const;
+    float PdfDistance(const Ray& ray, const float& t, Sampler& sampler) const;
+    uint32_t SelectLevel(const uint32_t& depth, const Spectrum& throughput) const;
 
     float Density(const Float3& p) const;
     Spectrum BlackbodyRadiance(const Float3& p) const;
+    // Emitted radiance per unit length, sigma_a * Le
+    Spectrum Emission(const Float3& p) const;
+    // Fills _mediumRec_ for a real collision, event 0 scatters and 1 absorbs
+    Spectrum Collide(
+        const int& event,
+        const Float3& p,
+        const float& t,
+        MediumRecord& mediumRec,
+        const Spectrum& weight) const;
+
+    // World space to VDB index space, the grid transform must be affine
+    Float3 WorldToIndex(const Float3& p) const;
+    Float3 IndexToWorld(const Float3& p) const;
+    void WorldToIndex(const Ray& ray, Float3& o, Float3& d) const;
+    float DensityIndex(const Float3& pIndex) const;
+    // Moves an index space ray into the index space of _level_ and returns its majorants
+    const MajorantGrid& LevelRay(const uint32_t& level, Float3& o, Float3& d) const;
+    // Lookup in the index space of _level_
+    float DensityLevel(const Float3& pLevel, const uint32_t& level) const;
+
+    // Clip [0, ray.tMax] to the world space bounds of the data
+    bool ClipRay(const Ray& ray, float& tMin, float& tMax) const;
+
+    // Lookup throughput against thread count
+    void Benchmark() const;
 
     
     Spectrum m_albedo;
@@ -38,13 +85,42 @@ public:
 
     typedef openvdb::tools::GridSampler<openvdb::FloatGrid, openvdb::tools::BoxSampler> VDBFloatSampler;
     typedef openvdb::FloatGrid::Ptr VDBFloatGridPtr;
+    typedef openvdb::FloatGrid::ConstAccessor VDBFloatAccessor;
+    typedef tbb::enumerable_thread_specific<VDBFloatAccessor> VDBThreadAccessors;
     VDBFloatGridPtr m_densityGrid;
     VDBFloatSampler m_densitySampler;
     VDBFloatGridPtr m_temperatureGrid;
     VDBFloatSampler m_temperatureSampler;
+    // Per-thread accessor keeps its node cache across coherent lookups
+    std::unique_ptr<VDBThreadAccessors> m_densityAccessors;
+
+    std::unique_ptr<MajorantGrid> m_majorantGrid;
+    // Active voxels dilated by the trilinear footprint
+    Bounds m_worldBounds;
+    // Baked density, replaces the VDB sampler when present
+    std::unique_ptr<BrickGrid> m_densityBricks;
+    // Blackbody radiance baked from the temperature grid, in its index space
+    std::unique_ptr<BrickGrid> m_emissionBricks;
+
+    // Dense copy of small, dense grids
+    std::unique_ptr<Grid> m_densityDense;
 
-    std::shared_ptr<Grid> m_dG;
+    // Box filtered density pyramid, level l voxels cover 2^l voxels of level 0.
+    // Every level keeps its own majorants, so coarse tracking stays unbiased for its density
+    class MipLevel {
+    public:
+        VDBFloatGridPtr m_grid;
+        std::unique_ptr<BrickGrid> m_bricks;
+        std::unique_ptr<MajorantGrid> m_majorantGrid;
+    };
+    std::vector<MipLevel> m_mipLevels;
+    // Coarse lookups start after _m_mipDepth_ bounces, or every halving
+    // of the throughput below _m_mipThroughput_ adds a level
+    uint32_t m_mipDepth;
+    float m_mipThroughput;
 
     bool m_lefthand;
     bool m_blackbody;
+    TransmittanceEstimator m_estimator;
+    bool m_decomposition;
 };
\ No newline at end of file
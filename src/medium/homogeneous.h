@@ -10,31 +10,48 @@ public:
         const Spectrum& sigmaS)
         :Medium(pf), m_sigmaA(sigmaA), m_sigmaS(sigmaS), m_sigmaT(sigmaA + sigmaS) {}
 
+    // Approximate multiple scattering (Wrenninge et al. 2017): octave k scales
+    // sigma_t by _msExtinction_^k and sigma_s by _msScattering_^k, so long
+    // paths escape dense, bright media in fewer bounces. The result is biased
+    // towards lower energy, _msScattering_ <= _msExtinction_ keeps the albedo <= 1.
     HomogeneousMedium(
         const std::shared_ptr<PhaseFunction>& pf,
         const Spectrum& density,
         const Spectrum& albedo,
-        const float& scale)
-        :Medium(pf), m_density(density), m_albedo(albedo), m_scale(scale)
+        const float& scale,
+        const uint32_t& msDepth = 0,
+        const uint32_t& msOctaves = 0,
+        const float& msExtinction = .5f,
+        const float& msScattering = .5f)
+        :Medium(pf), m_density(density), m_albedo(albedo), m_scale(scale), m_msDepth(msDepth)
     {
         m_sigmaT = density * scale;
         m_sigmaS = m_sigmaT * m_albedo;
         m_sigmaA = m_sigmaT - m_sigmaS;
+        LOG_IF(FATAL, msScattering > msExtinction) << "Multiple scattering octaves gain energy";
+        float extinction = 1, scattering = 1;
+        for (uint32_t octave = 1; octave <= msOctaves && msDepth > 0; octave++) {
+            extinction *= msExtinction;
+            scattering *= msScattering;
+            m_octaveSigmaT.push_back(m_sigmaT * extinction);
+            m_octaveSigmaS.push_back(m_sigmaS * scattering);
+        }
     }
 
-    Spectrum Sample(const Ray& ray, MediumRecord& mediumRec, Sampler& sampler) const {
+    Spectrum Sample(const Ray& ray, MediumRecord& mediumRec, Sampler& sampler, const uint32_t& level = 0) const {
+        const Spectrum& sigmaT = OctaveSigmaT(level);
         float maxT = std::min(ray.tMax, std::numeric_limits<float>::max()), t;
 
         uint32_t channel = std::min(int(sampler.Next1D() * 3), 2);
-        t = -std::log(1 - sampler.Next1D()) / m_sigmaT[channel];
+        t = -std::log(1 - sampler.Next1D()) / sigmaT[channel];
         mediumRec.m_internal = t < maxT;
         t = std::min(t, maxT);
-        Spectrum Tr = Exp(m_sigmaT * (-t));
+        Spectrum Tr = Exp(sigmaT * (-t));
 
         float pdf;
         if (mediumRec.m_internal) {
             mediumRec.m_p = ray(t);
-            pdf = (Tr * m_sigmaT).Average();
+            pdf = (Tr * sigmaT).Average();
         }
         else {
             pdf = Tr.Average();
@@ -42,16 +59,48 @@ public:
 
         mediumRec.m_t = t;
         mediumRec.m_pdf = pdf;
-        return mediumRec.m_internal ? m_sigmaS * Tr / pdf : Tr / pdf;
+        return mediumRec.m_internal ? OctaveSigmaS(level) * Tr / pdf : Tr / pdf;
     }
 
-    Spectrum Transmittance(const Ray& ray, Sampler& sampler) const {
+    Spectrum Transmittance(const Ray& ray, Sampler& sampler, const uint32_t& level = 0) const {
         float t = std::min(ray.tMax, std::numeric_limits<float>::max());
-        Spectrum Tr = Exp(m_sigmaT * (-t));
+        Spectrum Tr = Exp(OctaveSigmaT(level) * (-t));
         return Tr;
     }
 
+    Spectrum SigmaS(const Float3& p) const {
+        return m_sigmaS;
+    }
+
+    Spectrum SigmaT(const Float3& p) const {
+        return m_sigmaT;
+    }
+
+    float PdfDistance(const Ray& ray, const float& t, Sampler& sampler) const {
+        // Channel is chosen uniformly in Sample()
+        return (Exp(m_sigmaT * (-t)) * m_sigmaT).Average();
+    }
+
+    // Octave 0 is exact, every bounce from _msDepth_ on moves one octave up
+    uint32_t SelectLevel(const uint32_t& depth, const Spectrum& throughput) const {
+        if (m_octaveSigmaT.empty() || depth < m_msDepth) {
+            return 0;
+        }
+        return std::min(depth - m_msDepth + 1, uint32_t(m_octaveSigmaT.size()));
+    }
+
     Spectrum m_sigmaA, m_sigmaS, m_sigmaT;
     Spectrum m_density, m_albedo;
     float m_scale;
+
+private:
+    const Spectrum& OctaveSigmaT(const uint32_t& octave) const {
+        return octave == 0 ? m_sigmaT : m_octaveSigmaT[std::min(octave, uint32_t(m_octaveSigmaT.size())) - 1];
+    }
+    const Spectrum& OctaveSigmaS(const uint32_t& octave) const {
+        return octave == 0 ? m_sigmaS : m_octaveSigmaS[std::min(octave, uint32_t(m_octaveSigmaS.size())) - 1];
+    }
+
+    uint32_t m_msDepth;
+    std::vector<Spectrum> m_octaveSigmaT, m_octaveSigmaS;
 };
\ No newline at end of file
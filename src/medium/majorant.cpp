@@ -0,0 +1,118 @@
+#include "majorant.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+MajorantGrid::MajorantGrid(const openvdb::FloatGrid& grid, const uint32_t& blockSize)
+    : m_blockSize(std::max(blockSize, 1u))
+{
+    // Trilinear lookups reach one voxel beyond the active bounding box
+    openvdb::CoordBBox bbox = grid.evalActiveVoxelBoundingBox();
+    Int3 indexMin(bbox.min().x() - 1, bbox.min().y() - 1, bbox.min().z() - 1);
+    Int3 indexMax(bbox.max().x() + 1, bbox.max().y() + 1, bbox.max().z() + 1);
+    m_origin = Float3(indexMin);
+    for (int axis = 0; axis < 3; axis++) {
+        int dim = indexMax[axis] - indexMin[axis] + 1;
+        m_resolution[axis] = (dim + m_blockSize - 1) / m_blockSize;
+    }
+
+    float background = std::max(0.f, grid.background());
+    m_majorants.assign(size_t(m_resolution.x) * m_resolution.y * m_resolution.z, background);
+
+    // Lookups in block b use voxels [b * size, (b + 1) * size], so a voxel r
+    // (relative to the origin) bounds blocks (r - 1) / size to r / size
+    for (auto iter = grid.cbeginValueOn(); iter; ++iter) {
+        float value = iter.getValue();
+        openvdb::CoordBBox valueBBox;
+        iter.getBoundingBox(valueBBox);
+        Int3 b0, b1;
+        for (int axis = 0; axis < 3; axis++) {
+            int r0 = valueBBox.min()[axis] - indexMin[axis];
+            int r1 = valueBBox.max()[axis] - indexMin[axis];
+            b0[axis] = std::max((r0 - 1) / int(m_blockSize), 0);
+            b1[axis] = std::min(r1 / int(m_blockSize), m_resolution[axis] - 1);
+        }
+        for (int z = b0.z; z <= b1.z; z++) {
+            for (int y = b0.y; y <= b1.y; y++) {
+                for (int x = b0.x; x <= b1.x; x++) {
+                    float& majorant = m_majorants[Index(Int3(x, y, z))];
+                    majorant = std::max(majorant, value);
+                }
+            }
+        }
+    }
+
+    // Minorant needs every voxel of the footprint, inactive ones included
+    m_minorants.assign(m_majorants.size(), background);
+    auto job = [&](const tbb::blocked_range<uint32_t>& range) {
+        auto accessor = grid.getConstAccessor();
+        for (uint32_t idx = range.begin(); idx < range.end(); idx++) {
+            if (m_majorants[idx] == 0) {
+                m_minorants[idx] = 0;
+                continue;
+            }
+            int bx = idx % m_resolution.x;
+            int by = (idx / m_resolution.x) % m_resolution.y;
+            int bz = idx / (m_resolution.x * m_resolution.y);
+            Int3 voxelMin = indexMin + Int3(bx, by, bz) * int(m_blockSize);
+            float minorant = m_majorants[idx];
+            for (int z = 0; z <= int(m_blockSize) && minorant > 0; z++) {
+                for (int y = 0; y <= int(m_blockSize); y++) {
+                    for (int x = 0; x <= int(m_blockSize); x++) {
+                        openvdb::Coord coord(voxelMin.x + x, voxelMin.y + y, voxelMin.z + z);
+                        minorant = std::min(minorant, accessor.getValue(coord));
+                    }
+                }
+            }
+            m_minorants[idx] = std::max(minorant, 0.f);
+        }
+    };
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, m_majorants.size()), job);
+
+    m_maxMajorant = 0;
+    uint32_t emptyNum = 0;
+    for (const float& majorant : m_majorants) {
+        m_maxMajorant = std::max(m_maxMajorant, majorant);
+        emptyNum += majorant == 0;
+    }
+    std::cout << "Majorant grid : " << m_resolution.x << 'x' << m_resolution.y << 'x' << m_resolution.z
+        << ", " << emptyNum << " / " << m_majorants.size() << " empty blocks" << std::endl;
+}
+
+void MajorantGrid::Round(const std::function<float(const float&)>& round)
+{
+    for (size_t i = 0; i < m_majorants.size(); i++) {
+        m_majorants[i] = round(m_majorants[i]);
+        m_minorants[i] = round(m_minorants[i]);
+    }
+    m_maxMajorant = round(m_maxMajorant);
+}
+
+void MajorantGrid::Widen(const Int3& voxelMin, const Int3& voxelMax, const float& margin, const bool& widenEmpty)
+{
+    // Same block range as a voxel r in the constructor, floored for voxels below the origin
+    auto floorDiv = [](const int& v, const int& d) { return v >= 0 ? v / d : -((-v + d - 1) / d); };
+    Int3 b0, b1;
+    for (int axis = 0; axis < 3; axis++) {
+        int r0 = voxelMin[axis] - int(m_origin[axis]);
+        int r1 = voxelMax[axis] - int(m_origin[axis]);
+        b0[axis] = std::max(floorDiv(r0 - 1, int(m_blockSize)), 0);
+        b1[axis] = std::min(floorDiv(r1, int(m_blockSize)), m_resolution[axis] - 1);
+        if (b0[axis] > b1[axis]) {
+            return;
+        }
+    }
+    for (int z = b0.z; z <= b1.z; z++) {
+        for (int y = b0.y; y <= b1.y; y++) {
+            for (int x = b0.x; x <= b1.x; x++) {
+                uint32_t idx = Index(Int3(x, y, z));
+                if (m_majorants[idx] == 0 && !widenEmpty) {
+                    continue;
+                }
+                m_majorants[idx] += margin;
+                m_minorants[idx] = std::max(m_minorants[idx] - margin, 0.f);
+                m_maxMajorant = std::max(m_maxMajorant, m_majorants[idx]);
+            }
+        }
+    }
+}
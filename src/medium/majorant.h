@@ -0,0 +1,135 @@
+#pragma once
+
+#include "core/vector.h"
+
+#include <openvdb/openvdb.h>
+
+#include <functional>
+
+// Coarse grid of per-block maximum and minimum density over the index space
+// of a VDB grid. Blocks are dilated by one voxel so trilinear lookups stay bounded.
+class MajorantGrid {
+public:
+    MajorantGrid(const openvdb::FloatGrid& grid, const uint32_t& blockSize);
+
+    // Maps the bounds through the monotonic rounding of a lossy storage, so
+    // they bound the values it returns
+    void Round(const std::function<float(const float&)>& round);
+    // Loosens the bounds of the blocks whose lookups read voxels in
+    // [voxelMin, voxelMax] (index space) by _margin_, the quantization error
+    // of a lossy storage. Empty blocks stay empty unless _widenEmpty_
+    void Widen(const Int3& voxelMin, const Int3& voxelMax, const float& margin, const bool& widenEmpty);
+
+    float Majorant(const Int3& block) const {
+        return m_majorants[Index(block)];
+    }
+    float Minorant(const Int3& block) const {
+        return m_minorants[Index(block)];
+    }
+    uint32_t Index(const Int3& block) const {
+        return (block.z * m_resolution.y + block.y) * m_resolution.x + block.x;
+    }
+
+    // Index space position of block (0, 0, 0)
+    Float3 m_origin;
+    Int3 m_resolution;
+    uint32_t m_blockSize;
+    float m_maxMajorant;
+    std::vector<float> m_majorants;
+    std::vector<float> m_minorants;
+};
+
+class MajorantSegment {
+public:
+    float m_tMin, m_tMax;
+    float m_majorant;
+    float m_minorant;
+};
+
+// 3D DDA through the majorant grid (Amanatides and Woo),
+// the ray is given in index space and t is the world space distance
+class MajorantIterator {
+public:
+    MajorantIterator(
+        const MajorantGrid& grid,
+        const Float3& o,
+        const Float3& d,
+        float tMin,
+        float tMax)
+        : m_grid(&grid)
+    {
+        float invBlockSize = 1.f / grid.m_blockSize;
+        Float3 og = (o - grid.m_origin) * invBlockSize;
+        Float3 dg = d * invBlockSize;
+        // Clip to the grid
+        for (int axis = 0; axis < 3; axis++) {
+            float invD = 1.f / dg[axis];
+            float tNear = (0 - og[axis]) * invD;
+            float tFar = (grid.m_resolution[axis] - og[axis]) * invD;
+            if (tNear > tFar) {
+                std::swap(tNear, tFar);
+            }
+            tMin = tNear > tMin ? tNear : tMin;
+            tMax = tFar < tMax ? tFar : tMax;
+        }
+        m_tMin = tMin;
+        m_tMax = tMax;
+        if (m_tMin >= m_tMax) {
+            return;
+        }
+
+        Float3 p = og + dg * m_tMin;
+        for (int axis = 0; axis < 3; axis++) {
+            m_voxel[axis] = std::clamp(int(std::floor(p[axis])), 0, grid.m_resolution[axis] - 1);
+            m_deltaT[axis] = 1.f / std::fabs(dg[axis]);
+            if (dg[axis] >= 0) {
+                float nextVoxelPos = float(m_voxel[axis] + 1);
+                m_nextCrossingT[axis] = m_tMin + (nextVoxelPos - p[axis]) / dg[axis];
+                m_step[axis] = 1;
+                m_voxelLimit[axis] = grid.m_resolution[axis];
+            }
+            else {
+                float nextVoxelPos = float(m_voxel[axis]);
+                m_nextCrossingT[axis] = m_tMin + (nextVoxelPos - p[axis]) / dg[axis];
+                m_step[axis] = -1;
+                m_voxelLimit[axis] = -1;
+            }
+        }
+    }
+
+    bool Next(MajorantSegment& seg) {
+        if (m_tMin >= m_tMax) {
+            return false;
+        }
+        // Axis with the closest crossing
+        int bits = ((m_nextCrossingT[0] < m_nextCrossingT[1]) << 2) +
+            ((m_nextCrossingT[0] < m_nextCrossingT[2]) << 1) +
+            ((m_nextCrossingT[1] < m_nextCrossingT[2]));
+        const int cmpToAxis[8] = { 2, 1, 2, 1, 2, 2, 0, 0 };
+        int stepAxis = cmpToAxis[bits];
+        float tVoxelExit = std::min(m_tMax, m_nextCrossingT[stepAxis]);
+
+        seg.m_tMin = m_tMin;
+        seg.m_tMax = tVoxelExit;
+        uint32_t blockIdx = m_grid->Index(Int3(m_voxel[0], m_voxel[1], m_voxel[2]));
+        seg.m_majorant = m_grid->m_majorants[blockIdx];
+        seg.m_minorant = m_grid->m_minorants[blockIdx];
+
+        m_tMin = tVoxelExit;
+        if (m_nextCrossingT[stepAxis] > m_tMax) {
+            m_tMin = m_tMax;
+        }
+        m_voxel[stepAxis] += m_step[stepAxis];
+        if (m_voxel[stepAxis] == m_voxelLimit[stepAxis]) {
+            m_tMin = m_tMax;
+        }
+        m_nextCrossingT[stepAxis] += m_deltaT[stepAxis];
+        return true;
+    }
+
+private:
+    const MajorantGrid* m_grid;
+    float m_tMin, m_tMax;
+    float m_nextCrossingT[3], m_deltaT[3];
+    int m_step[3], m_voxelLimit[3], m_voxel[3];
+};
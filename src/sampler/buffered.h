@@ -0,0 +1,63 @@
+#pragma once
+
+#include "core/sampler.h"
+
+#include "pcg32/pcg32_8.h"
+
+// Fills a per-path sample array with 8 parallel pcg32 streams (AVX2 when
+// available) and hands the samples out by index, so the path loop does not
+// wait on the serial pcg32 state update for every dimension
+class BufferedSampler final : public Sampler {
+public:
+    static constexpr uint32_t max_dimension = 256;
+
+    BufferedSampler(const uint32_t& dimension)
+        : m_index(0)
+    {
+        // Round up to full 8-lane steps
+        m_size = std::min((std::max(dimension, 1u) + 7) & ~7u, max_dimension);
+    }
+
+    void Setup(uint64_t s) {
+        PCG32_ALIGN(32) uint64_t initState[8];
+        PCG32_ALIGN(32) uint64_t initSeq[8];
+        for (uint32_t i = 0; i < 8; i++) {
+            initState[i] = s;
+            initSeq[i] = (s << 3) + i;
+        }
+        m_rng.seed(initState, initSeq);
+        Fill();
+    }
+
+    // Every path starts from a fresh array
+    void StartPixel(const Int2& pixel, const uint32_t& index) {
+        Fill();
+    }
+
+    float Next1D() {
+        if (m_index == m_size) {
+            Fill();
+        }
+        return m_samples[m_index++];
+    }
+    Float2 Next2D() {
+        if (m_index + 2 > m_size) {
+            Fill();
+        }
+        Float2 u(m_samples[m_index], m_samples[m_index + 1]);
+        m_index += 2;
+        return u;
+    }
+
+private:
+    void Fill() {
+        for (uint32_t i = 0; i < m_size; i += 8) {
+            m_rng.nextFloat(m_samples + i);
+        }
+        m_index = 0;
+    }
+
+    pcg32_8 m_rng;
+    PCG32_ALIGN(32) float m_samples[max_dimension];
+    uint32_t m_size, m_index;
+};
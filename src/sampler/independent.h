@@ -4,7 +4,7 @@
 
 #include "pcg32/pcg32.h"
 
-class IndependentSampler : public Sampler {
+class IndependentSampler final : public Sampler {
 public:
     IndependentSampler() { }
 
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "core/sampler.h"
+#include "utility/math.h"
+
+// Z-order scrambled Sobol sampler (Ahmed and Wonka 2020, pbrt-v4 ZSobolSampler)
+// Pixels are visited along a Morton curve and every base-4 digit of the sample
+// index is randomly permuted, so neighbouring pixels receive decorrelated but
+// well-distributed points and error is pushed into high screen frequencies
+class ZSobolSampler final : public Sampler {
+public:
+    ZSobolSampler(
+        const uint32_t& spp,
+        const Int2& resolution,
+        const uint32_t& seed = 0)
+        : m_seed(seed), m_dimension(0), m_mortonIndex(0)
+    {
+        m_log2spp = math::Log2Int(math::RoundUpPow2(std::max(spp, 1u)));
+        uint32_t res = math::RoundUpPow2(std::max(resolution.x, resolution.y));
+        uint32_t log4spp = (m_log2spp + 1) / 2;
+        m_base4Digits = math::Log2Int(res) + log4spp;
+    }
+
+    void Setup(uint64_t s) {
+        // Sequence is fully determined by pixel and sample index
+    }
+
+    void StartPixel(const Int2& pixel, const uint32_t& index) {
+        m_dimension = 0;
+        m_mortonIndex = (math::EncodeMorton2(pixel.x, pixel.y) << m_log2spp) | index;
+    }
+
+    float Next1D() {
+        uint64_t sampleIndex = SampleIndex();
+        m_dimension++;
+        uint32_t hash = uint32_t(Hash(sampleIndex));
+        return Scramble(math::ReverseBits32(uint32_t(sampleIndex)), hash);
+    }
+    Float2 Next2D() {
+        uint64_t sampleIndex = SampleIndex();
+        m_dimension += 2;
+        uint64_t hash = Hash(sampleIndex);
+        return Float2(
+            Scramble(math::ReverseBits32(uint32_t(sampleIndex)), uint32_t(hash)),
+            Scramble(Sobol1(uint32_t(sampleIndex)), uint32_t(hash >> 32)));
+    }
+
+private:
+    // The 32-bit Sobol points only see the low 32 bits of the index, larger
+    // images and sample counts (2 * m_base4Digits > 32) give the high digits
+    // their own scramble instead of reusing the points of other pixels.
+    // MixBits(0) is 0, so smaller indices keep the plain per-dimension hash
+    uint64_t Hash(const uint64_t& sampleIndex) const {
+        return math::MixBits((uint64_t(m_dimension) << 32) ^ m_seed ^ math::MixBits(sampleIndex >> 32));
+    }
+
+    uint64_t SampleIndex() const {
+        static const uint8_t permutations[24][4] = {
+            {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1},
+            {0, 3, 2, 1}, {0, 3, 1, 2}, {1, 0, 2, 3}, {1, 0, 3, 2},
+            {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+            {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1},
+            {2, 3, 0, 1}, {2, 3, 1, 0}, {3, 1, 2, 0}, {3, 1, 0, 2},
+            {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2}
+        };
+
+        uint64_t sampleIndex = 0;
+        // Odd power of 2 spp leaves a single base-2 digit at the bottom
+        bool pow2Samples = m_log2spp & 1;
+        int lastDigit = pow2Samples ? 1 : 0;
+        for (int i = m_base4Digits - 1; i >= lastDigit; i--) {
+            int digitShift = 2 * i - (pow2Samples ? 1 : 0);
+            int digit = (m_mortonIndex >> digitShift) & 3;
+            uint64_t higherDigits = m_mortonIndex >> (digitShift + 2);
+            int p = (math::MixBits(higherDigits ^ (0x55555555u * m_dimension)) >> 24) % 24;
+            digit = permutations[p][digit];
+            sampleIndex |= uint64_t(digit) << digitShift;
+        }
+        if (pow2Samples) {
+            int digit = m_mortonIndex & 1;
+            sampleIndex |= digit ^ (math::MixBits((m_mortonIndex >> 1) ^ (0x55555555u * m_dimension)) & 1);
+        }
+        return sampleIndex;
+    }
+
+    // Second Sobol dimension, generator columns v[i] = v[i-1] ^ (v[i-1] >> 1)
+    static uint32_t Sobol1(uint32_t a) {
+        uint32_t v = 0;
+        for (uint32_t c = 0x80000000u; a != 0; a >>= 1, c ^= c >> 1) {
+            if (a & 1) {
+                v ^= c;
+            }
+        }
+        return v;
+    }
+
+    // Laine-Karras style hash based Owen scrambling
+    static float Scramble(uint32_t v, uint32_t seed) {
+        v = math::ReverseBits32(v);
+        v ^= v * 0x3d20adea;
+        v += seed;
+        v *= (seed >> 16) | 1;
+        v ^= v * 0x05526c56;
+        v ^= v * 0x53a22864;
+        v = math::ReverseBits32(v);
+        return std::min(v * 0x1p-32f, 0x1.fffffep-1f);
+    }
+
+    uint32_t m_seed;
+    uint32_t m_log2spp, m_base4Digits;
+    uint32_t m_dimension;
+    uint64_t m_mortonIndex;
+};
@@ -1,9 +1,60 @@
 #pragma once
 
+#include <stdint.h>
+
 namespace math {
     float Signum(float v);
     float SafeSqrt(float v);
     float Sqr(float v);
     bool SolveQuadratic(float a, float b, float c, float& x0, float& x1);
     bool SolveQuadraticDouble(double a, double b, double c, double& x0, double& x1);
-}
\ No newline at end of file
+
+    // Bit manipulation
+    inline uint32_t ReverseBits32(uint32_t v) {
+        v = (v << 16) | (v >> 16);
+        v = ((v & 0x00ff00ff) << 8) | ((v & 0xff00ff00) >> 8);
+        v = ((v & 0x0f0f0f0f) << 4) | ((v & 0xf0f0f0f0) >> 4);
+        v = ((v & 0x33333333) << 2) | ((v & 0xcccccccc) >> 2);
+        v = ((v & 0x55555555) << 1) | ((v & 0xaaaaaaaa) >> 1);
+        return v;
+    }
+
+    inline uint64_t MixBits(uint64_t v) {
+        v ^= (v >> 31);
+        v *= 0x7fb5d329728ea185ull;
+        v ^= (v >> 27);
+        v *= 0x81dadef4bc2dd44dull;
+        v ^= (v >> 33);
+        return v;
+    }
+
+    inline uint32_t Log2Int(uint64_t v) {
+        uint32_t r = 0;
+        while (v >>= 1) {
+            r++;
+        }
+        return r;
+    }
+
+    inline uint64_t RoundUpPow2(uint64_t v) {
+        v--;
+        v |= v >> 1; v |= v >> 2; v |= v >> 4;
+        v |= v >> 8; v |= v >> 16; v |= v >> 32;
+        return v + 1;
+    }
+
+    // Insert a zero bit between each of the lower 32 bits
+    inline uint64_t LeftShift2(uint64_t x) {
+        x &= 0xffffffff;
+        x = (x ^ (x << 16)) & 0x0000ffff0000ffffull;
+        x = (x ^ (x << 8)) & 0x00ff00ff00ff00ffull;
+        x = (x ^ (x << 4)) & 0x0f0f0f0f0f0f0f0full;
+        x = (x ^ (x << 2)) & 0x3333333333333333ull;
+        x = (x ^ (x << 1)) & 0x5555555555555555ull;
+        return x;
+    }
+
+    inline uint64_t EncodeMorton2(uint32_t x, uint32_t y) {
+        return (LeftShift2(y) << 1) | LeftShift2(x);
+    }
+}